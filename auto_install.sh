@@ -3,6 +3,7 @@
 # XMOS Public Licence, Version 1
 pushd "$( dirname "${BASH_SOURCE[0]}" )" > /dev/null
 SETUP_DIR="$( pwd )"
+source $SETUP_DIR/tools/avs_common.sh
 RPI_SETUP_REPO=vocalfusion-rpi-setup
 RPI_SETUP_DIR=$SETUP_DIR/$RPI_SETUP_REPO
 RPI_SETUP_SCRIPT=$RPI_SETUP_DIR/setup.sh
@@ -21,6 +22,89 @@ DEVICE_SERIAL_NUMBER="123456"
 GPIO_KEY_WORD_DETECTOR_FLAG=""
 # Disable HID keyword detector by default
 HID_KEY_WORD_DETECTOR_FLAG=""
+# Set up the Raspberry Pi as well as the AVS SDK by default
+BUILD_ONLY=
+# Disable incremental re-install by default
+INCREMENTAL_INSTALL=
+# Number of parallel AVS SDK build jobs, worked out from the number of CPUs
+# and the free memory if nothing is specified
+BUILD_JOBS=
+# Memory needed by each AVS SDK build job
+BUILD_JOB_MEMORY_KB=$(( 512 * 1024 ))
+# Disable compiler cache by default
+CCACHE_DIR=
+# Build the AVS SDK on the SD card by default, rather than in memory
+BUILD_STAGING=
+# Memory needed to stage the AVS SDK build directory in tmpfs, zram swap is
+# used for the build instead on Raspberry Pis with less memory
+BUILD_TMPFS_MIN_MEMORY_KB=$(( 3584 * 1024 ))
+# Extra CMake options for the AVS SDK build
+CMAKE_EXTRA_ARGS=()
+# Build the AVS SDK from source by default, rather than installing a
+# prebuilt artifact
+ARTIFACT_LOCATION=
+# Do not create a prebuilt artifact by default
+ARTIFACT_OUTPUT_DIR=
+# Disable download cache by default
+DOWNLOAD_CACHE_DIR=
+# Disable pipelined install by default
+PIPELINED_INSTALL=
+# Log of the downloads made in the background by the pipelined install
+PREFETCH_LOG=$SETUP_DIR/prefetch.log
+# Report of the time and resources taken by each install stage, saved next
+# to the config JSON file
+INSTALL_REPORT_FILE=$SETUP_DIR/install_report.json
+# Number of seconds between the resource samples of the install report
+INSTALL_MONITOR_INTERVAL=2
+# Depth of the Sample App audio capture buffer in milliseconds, left to the
+# AVS SDK default if nothing is specified
+CAPTURE_BUFFER_MS=
+# Whether the capture buffer depth is the one of the latency profile
+CAPTURE_BUFFER_FROM_PROFILE=
+# Audio latency profile, the ALSA configuration of the Raspberry Pi setup
+# is left unchanged if nothing is specified
+LATENCY_PROFILE=
+# ALSA period time in microseconds and number of periods of each latency
+# profile, for the devices connected over I2S and USB
+LATENCY_PROFILES="
+  low-latency:i2s:8000:3
+  low-latency:usb:8000:4
+  balanced:i2s:16000:4
+  balanced:usb:16000:4
+  low-cpu:i2s:64000:4
+  low-cpu:usb:64000:4"
+# Do not add the comms channel PCM by default
+COMMS_PCM=
+# Devices with separate ASR and comms output channels, and the channel of
+# the comms output
+COMMS_DEVICES="xvf3510 xvf3600-slave xvf3600-master xvf3610-int xvf3610-ua xvf3615-int xvf3615-ua"
+COMMS_CHANNEL=1
+# Do not install the fast-boot Sample App service by default
+FAST_BOOT=
+# Do not use the low-power idle mode by default
+LOW_POWER_IDLE=
+# Timer slack of the Sample App in the low-power idle mode, letting the
+# kernel group the timer wakeups of the SDK threads
+IDLE_TIMER_SLACK_NS=2000000
+# Do not reserve a CPU for the Sample App by default
+CPU_RESERVATION=
+# Kernel command line file of the Raspberry Pi
+BOOT_CMDLINE_FILE=/boot/cmdline.txt
+# Do not install the Sample App metrics service by default
+METRICS_SERVICE=
+# Do not use the headless install profile by default
+HEADLESS=
+# Build the AVS SDK with the default features of the AVS setup.sh, unless a
+# feature manifest is specified
+FEATURE_MANIFEST=
+# CMake options set by the AVS setup.sh and pi.sh which the Sample App of
+# this setup cannot be built without
+REQUIRED_FEATURES="GSTREAMER_MEDIA_PLAYER PORTAUDIO SENSORY_KEY_WORD_DETECTOR GPIO_KEY_WORD_DETECTOR HID_KEY_WORD_DETECTOR"
+# Desktop session autostart file to which the AVS setup.sh may add the Sample
+# App, replaced by the fast-boot service
+DESKTOP_AUTOSTART_FILE=$HOME/.config/lxsession/LXDE-pi/autostart
+# Aliases for the tools run against the Sample App, added next to avsrun
+TOOL_ALIASES="avsbench=avs_benchmark.sh avstune=avs_tune_sensory.sh avsboot=avs_boot_report.sh avsfrontend=avs_frontend_benchmark.sh avssoak=avs_soak_test.sh avsreplay=avs_replay.sh"
 
 usage() {
   local VALID_XMOS_DEVICES_DISPLAY_STRING=
@@ -51,8 +135,67 @@ The DEVICE-TYPE is the XMOS device to setup: $VALID_XMOS_DEVICES_DISPLAY_STRING
 Optional parameters:
   -s <serial-number>  If nothing is provided, the default device serial number
                       is 123456
+  -S                  Flag to skip the Raspberry Pi setup and only build the
+                      AVS SDK, for example to create a prebuilt artifact
+                      with -o in a container
+  -B <milliseconds>   Depth of the Sample App audio capture buffer, written
+                      into the AVS SDK configuration. If nothing is
+                      provided, the AVS SDK default is used
+  -b <location>       Install a prebuilt AVS SDK artifact from the given
+                      directory or URL instead of building from source.
+                      The artifact must have been created with -o by a
+                      user with the same home directory
+  -c <cache-dir>      Compile the AVS SDK through ccache, keeping the cache
+                      in the given directory. The directory can be shared
+                      between devices, for example on a USB stick or NFS
+  -d <cache-dir>      Keep the downloaded files and repositories in the given
+                      cache directory, so that they are only downloaded once
+  -f                  Flag to start the Sample App at boot with a systemd
+                      service as soon as the sound card is ready, rather
+                      than from the desktop session
+  -F <manifest>       Build the AVS SDK with the features of the given
+                      manifest file, with one CMake option per line such
+                      as BUILD_TESTING=OFF
   -G                  Flag to enable keyword detector on GPIO interrupt
   -H                  Flag to enable keyword detector on HID event
+  -i                  Flag to re-install incrementally: the existing
+                      Raspberry Pi setup and AVS SDK build are kept, and
+                      only the stages whose inputs have changed are redone
+  -j <jobs>           Number of parallel AVS SDK build jobs. If nothing is
+                      provided, it is worked out from the number of CPUs
+                      and the free memory and swap
+  -l <profile>        Audio latency profile: low-latency, balanced or low-cpu.
+                      The ALSA period and buffer sizes of the profile for the
+                      device are written into the ALSA configuration and the
+                      AVS SDK configuration
+  -L                  Flag to lower the CPU load of the Sample App while it
+                      waits for the keyword detected by the device with -G
+                      or -H: the Sample App is run by the service of -f with
+                      a timer slack, and the low-cpu latency profile is used
+                      unless -l is given
+  -M                  Flag to export the Sample App metrics for Prometheus
+                      with the avs-metrics service, which reads the output of
+                      the Sample App run by the service of -f
+  -m                  Flag to add the vocalfusion_comms ALSA PCM, which reads
+                      the comms channel from the capture buffer shared with
+                      the AVS SDK, for devices with ASR and comms channels
+  -n                  Flag to install for a Raspberry Pi without a desktop:
+                      the AVS SDK is built for a smaller size, the Sample App
+                      is run by a service as with -f and boots to the console
+  -o <output-dir>     Create a prebuilt AVS SDK artifact in the given
+                      directory once the AVS SDK is built
+  -p                  Flag to install in a pipeline: the AVS SDK install
+                      scripts, sources and packages are downloaded in the
+                      background while the Raspberry Pi is set up
+  -R                  Flag to reserve a CPU for the Sample App of the
+                      service of -f: the other processes and the interrupts
+                      are kept off the last CPU. The Sample App keeps the
+                      normal scheduling, it is not run with a real-time
+                      scheduling policy
+  -t                  Flag to build the AVS SDK in memory: in tmpfs on a
+                      Raspberry Pi with enough memory, or else with zram
+                      swap, copying only the build results to the SD card,
+                      with the object files kept for -i
   -h                  Display this help and exit
 EOT
 }
@@ -73,18 +216,72 @@ fi
 XMOS_DEVICE=$1
 shift 1
 
-OPTIONS=s:GHh
+OPTIONS=s:SB:b:c:d:F:fGHij:Ll:Mmno:pRth
 while getopts "$OPTIONS" opt ; do
     case $opt in
         s )
             DEVICE_SERIAL_NUMBER="$OPTARG"
             ;;
+        S )
+            BUILD_ONLY=y
+            ;;
+        B )
+            CAPTURE_BUFFER_MS="$OPTARG"
+            ;;
+        b )
+            ARTIFACT_LOCATION="$OPTARG"
+            ;;
+        c )
+            CCACHE_DIR="$OPTARG"
+            ;;
+        d )
+            DOWNLOAD_CACHE_DIR="$OPTARG"
+            ;;
+        F )
+            FEATURE_MANIFEST="$OPTARG"
+            ;;
+        f )
+            FAST_BOOT=y
+            ;;
         G )
             GPIO_KEY_WORD_DETECTOR_FLAG="-G"
             ;;
         H )
             HID_KEY_WORD_DETECTOR_FLAG="-H"
             ;;
+        i )
+            INCREMENTAL_INSTALL=y
+            ;;
+        j )
+            BUILD_JOBS="$OPTARG"
+            ;;
+        L )
+            LOW_POWER_IDLE=y
+            ;;
+        l )
+            LATENCY_PROFILE="$OPTARG"
+            ;;
+        M )
+            METRICS_SERVICE=y
+            ;;
+        m )
+            COMMS_PCM=y
+            ;;
+        n )
+            HEADLESS=y
+            ;;
+        o )
+            ARTIFACT_OUTPUT_DIR="$OPTARG"
+            ;;
+        p )
+            PIPELINED_INSTALL=y
+            ;;
+        R )
+            CPU_RESERVATION=y
+            ;;
+        t )
+            BUILD_STAGING=y
+            ;;
         h )
             usage
             exit 1
@@ -110,28 +307,167 @@ if ! validate_device $XMOS_DEVICE $VALID_XMOS_DEVICES; then
   exit 1
 fi
 
-# Exit if chromium browser is open
-if pgrep chromium > /dev/null ; then
-  echo "Error: Chromium browser is open"
-  echo "Please close the browser and restart the installation procedure"
-  exit 2
+if [[ -n "$BUILD_JOBS" && ! "$BUILD_JOBS" =~ ^[1-9][0-9]*$ ]]; then
+  echo "error: $BUILD_JOBS is not a valid number of build jobs."
+  echo
+  usage
+  exit 1
 fi
 
-# Amazon have changed the SDK directory structure. Prior versions will need to delete the directory before updating.
-SDK_DIR=$HOME/sdk-folder
-if [ -d $SDK_DIR ]; then
-  echo "Delete $SDK_DIR directory"
-  rm -rf $SDK_DIR
+if [[ -n "$CAPTURE_BUFFER_MS" && ! "$CAPTURE_BUFFER_MS" =~ ^[1-9][0-9]*$ ]]; then
+  echo "error: $CAPTURE_BUFFER_MS is not a valid capture buffer depth."
+  echo
+  usage
+  exit 1
+fi
+
+# Print the ALSA period time and number of periods of a latency profile for
+# the device
+latency_profile_settings() {
+  local INTERFACE=i2s
+  local SETTINGS
+  if [[ "$2" == *-ua ]]; then
+    INTERFACE=usb
+  fi
+  for SETTINGS in $LATENCY_PROFILES; do
+    if [[ "$SETTINGS" == "$1:$INTERFACE:"* ]]; then
+      echo "${SETTINGS#$1:$INTERFACE:}" | tr : ' '
+      return 0
+    fi
+  done
+  return 1
+}
+
+# The low-power idle mode is for the devices detecting the keyword, and
+# wakes the Sample App less often for the captured audio
+if [ -n "$LOW_POWER_IDLE" ]; then
+  if [[ -z "$GPIO_KEY_WORD_DETECTOR_FLAG$HID_KEY_WORD_DETECTOR_FLAG" && "$XMOS_DEVICE" != xvf3615-* ]]; then
+    echo "error: the low-power idle mode needs the keyword detector on GPIO interrupt or HID event."
+    echo
+    usage
+    exit 1
+  fi
+  if [ -z "$LATENCY_PROFILE" ]; then
+    LATENCY_PROFILE=low-cpu
+  fi
+  FAST_BOOT=y
 fi
 
-mkdir $SDK_DIR
+if [ -n "$LATENCY_PROFILE" ]; then
+  if ! LATENCY_PROFILE_SETTINGS=$(latency_profile_settings $LATENCY_PROFILE $XMOS_DEVICE); then
+    echo "error: $LATENCY_PROFILE is not a valid latency profile."
+    echo
+    usage
+    exit 1
+  fi
+  ALSA_PERIOD_TIME_US=${LATENCY_PROFILE_SETTINGS% *}
+  ALSA_PERIODS=${LATENCY_PROFILE_SETTINGS#* }
+  # The Sample App captures a whole ALSA buffer, unless told otherwise
+  if [ -z "$CAPTURE_BUFFER_MS" ]; then
+    CAPTURE_BUFFER_MS=$(( ALSA_PERIOD_TIME_US * ALSA_PERIODS / 1000 ))
+    CAPTURE_BUFFER_FROM_PROFILE=y
+  fi
+fi
 
-if [ -d $RPI_SETUP_DIR ]; then
-  echo "Delete $RPI_SETUP_DIR directory"	
-  rm -rf $RPI_SETUP_DIR
+if [ -n "$COMMS_PCM" ] && ! validate_device $XMOS_DEVICE $COMMS_DEVICES; then
+  echo "error: $XMOS_DEVICE does not have a comms channel."
+  echo
+  usage
+  exit 1
 fi
 
-git clone -b $RPI_SETUP_TAG https://github.com/xmos/$RPI_SETUP_REPO.git
+# Print the CMake options of a feature manifest, with one OPTION=ON or
+# OPTION=OFF per line and # comments
+feature_manifest_args() {
+  local LINE
+  local FEATURE
+  sed -e 's/#.*//' -e 's/[[:space:]]//g' $1 | while read -r LINE || [ -n "$LINE" ]; do
+    if [ -z "$LINE" ]; then
+      continue
+    fi
+    if [[ ! "$LINE" =~ ^[A-Z][A-Z0-9_]*=(ON|OFF)$ ]]; then
+      echo "error: $LINE is not a valid feature in $1." >&2
+      return 1
+    fi
+    FEATURE=${LINE%=*}
+    if validate_device $FEATURE $REQUIRED_FEATURES; then
+      echo "error: $FEATURE is needed by the Sample App and cannot be set in $1." >&2
+      return 1
+    fi
+    echo "-D$LINE"
+  done
+}
+
+if [ -n "$FEATURE_MANIFEST" ]; then
+  if [ ! -f "$FEATURE_MANIFEST" ]; then
+    echo "error: feature manifest $FEATURE_MANIFEST not found."
+    echo
+    usage
+    exit 1
+  fi
+  if ! FEATURE_ARGS=$(feature_manifest_args $FEATURE_MANIFEST); then
+    echo
+    usage
+    exit 1
+  fi
+  CMAKE_EXTRA_ARGS+=($FEATURE_ARGS)
+fi
+
+# The CPU reservation keeps the last CPU for the Sample App service
+if [ -n "$CPU_RESERVATION" ]; then
+  RESERVED_CPU=$(( $(nproc) - 1 ))
+  if [[ $RESERVED_CPU -lt 1 ]]; then
+    echo "error: the CPU reservation needs more than one CPU."
+    echo
+    usage
+    exit 1
+  fi
+  FAST_BOOT=y
+fi
+
+# The metrics are read from the output of the Sample App service
+if [ -n "$METRICS_SERVICE" ]; then
+  FAST_BOOT=y
+fi
+
+# The headless build is optimised for size rather than built for debug as
+# by the AVS setup.sh, and the Sample App is run by a service
+if [ -n "$HEADLESS" ]; then
+  CMAKE_EXTRA_ARGS+=(-DCMAKE_BUILD_TYPE=MINSIZEREL)
+  FAST_BOOT=y
+fi
+
+if [ -n "$CCACHE_DIR" ]; then
+  if ! mkdir -p "$CCACHE_DIR"; then
+    echo "error: cannot create ccache directory $CCACHE_DIR."
+    exit 1
+  fi
+  CCACHE_DIR="$( cd "$CCACHE_DIR" && pwd )"
+  CMAKE_EXTRA_ARGS+=(-DCMAKE_C_COMPILER_LAUNCHER=ccache -DCMAKE_CXX_COMPILER_LAUNCHER=ccache)
+fi
+
+if [ -n "$ARTIFACT_OUTPUT_DIR" ]; then
+  if ! mkdir -p "$ARTIFACT_OUTPUT_DIR"; then
+    echo "error: cannot create artifact directory $ARTIFACT_OUTPUT_DIR."
+    exit 1
+  fi
+  ARTIFACT_OUTPUT_DIR="$( cd "$ARTIFACT_OUTPUT_DIR" && pwd )"
+fi
+
+if [ -n "$DOWNLOAD_CACHE_DIR" ]; then
+  if ! mkdir -p "$DOWNLOAD_CACHE_DIR"; then
+    echo "error: cannot create download cache directory $DOWNLOAD_CACHE_DIR."
+    exit 1
+  fi
+  DOWNLOAD_CACHE_DIR="$( cd "$DOWNLOAD_CACHE_DIR" && pwd )"
+fi
+
+# Exit if chromium browser is open
+if pgrep chromium > /dev/null ; then
+  echo "Error: Chromium browser is open"
+  echo "Please close the browser and restart the installation procedure"
+  exit 2
+fi
 
 # Convert xvf3615 device into xvf3610 device and '-g' argument
 if [[ "$XMOS_DEVICE" == "xvf3615-int" ]]; then
@@ -143,24 +479,1027 @@ if [[ "$XMOS_DEVICE" == "xvf3615-ua" ]]; then
   HID_KEY_WORD_DETECTOR_FLAG="-H"
 fi
 
-# Execute (rather than source) the setup scripts
-echo "Installing VocalFusion ${XMOS_DEVICE:3} Raspberry Pi Setup..."
-if $RPI_SETUP_SCRIPT $XMOS_DEVICE; then
+# Read the inputs a stage was last completed with
+state_get() {
+  if [ -f $STATE_FILE ]; then
+    grep "^$1=" $STATE_FILE | cut -d= -f2-
+  fi
+}
+
+# Record the inputs a stage has been completed with
+state_set() {
+  touch $STATE_FILE
+  sed -i "/^$1=/d" $STATE_FILE
+  echo "$1=$2" >> $STATE_FILE
+}
+
+# Check if a stage can be skipped by the incremental re-install
+stage_is_current() {
+  [[ -n "$INCREMENTAL_INSTALL" && "$(state_get $1)" == "$2" ]]
+}
+
+# Download a file through the download cache, if there is one. The cached
+# files are stored by the SHA-256 of their content. They are looked up by the
+# given SHA-256 of the content, for the files which can change at the same
+# URL such as the prebuilt artifacts, or else by the SHA-256 of their URL as
+# these URLs are pinned to release tags.
+download() {
+  local URL=$1
+  local FILE=$2
+  local CONTENT_KEY=$3
+  local URL_ENTRY=
+  if [ -z "$DOWNLOAD_CACHE_DIR" ]; then
+    wget -O $FILE $URL
+    return
+  fi
+  if [ -z "$CONTENT_KEY" ]; then
+    URL_ENTRY=$DOWNLOAD_CACHE_DIR/urls/$(echo -n $URL | sha256sum | cut -d' ' -f1)
+    if [ -f $URL_ENTRY ]; then
+      CONTENT_KEY=$(cat $URL_ENTRY)
+    fi
+  fi
+  if [ -n "$CONTENT_KEY" ]; then
+    if echo "$CONTENT_KEY  $DOWNLOAD_CACHE_DIR/objects/$CONTENT_KEY" | sha256sum -c --status 2> /dev/null; then
+      echo "Using cached $URL"
+      cp $DOWNLOAD_CACHE_DIR/objects/$CONTENT_KEY $FILE
+      return
+    fi
+  fi
+  mkdir -p $DOWNLOAD_CACHE_DIR/urls $DOWNLOAD_CACHE_DIR/objects
+  local TEMP_FILE=$(mktemp -p $DOWNLOAD_CACHE_DIR)
+  if ! wget -O $TEMP_FILE $URL; then
+    rm -f $TEMP_FILE
+    return 1
+  fi
+  CONTENT_KEY=$(sha256sum $TEMP_FILE | cut -d' ' -f1)
+  mv $TEMP_FILE $DOWNLOAD_CACHE_DIR/objects/$CONTENT_KEY
+  if [ -n "$URL_ENTRY" ]; then
+    echo $CONTENT_KEY > $URL_ENTRY
+  fi
+  cp $DOWNLOAD_CACHE_DIR/objects/$CONTENT_KEY $FILE
+}
+
+# Make a shallow clone of a repository at a release tag, through the
+# download cache if there is one
+clone_tag() {
+  local URL=$1
+  local TAG=$2
+  local DIR=$3
+  if [ -z "$DOWNLOAD_CACHE_DIR" ]; then
+    git clone --depth 1 -b $TAG $URL $DIR
+    return
+  fi
+  local CACHED_DIR=$DOWNLOAD_CACHE_DIR/git/$(basename $URL .git)-$TAG
+  if [ -d $CACHED_DIR ]; then
+    echo "Using cached $URL $TAG"
+  else
+    rm -rf $CACHED_DIR.tmp
+    mkdir -p $DOWNLOAD_CACHE_DIR/git
+    if ! git clone --depth 1 -b $TAG $URL $CACHED_DIR.tmp; then
+      rm -rf $CACHED_DIR.tmp
+      return 1
+    fi
+    mv $CACHED_DIR.tmp $CACHED_DIR
+  fi
+  cp -a $CACHED_DIR $DIR
+}
+
+# Sample the memory, swap, CPU temperature and throttle state of the
+# Raspberry Pi for the install report
+sample_install_resources() {
+  local TEMP_MC=-
+  local THROTTLED=0
+  if [ -f /sys/class/thermal/thermal_zone0/temp ]; then
+    TEMP_MC=$(cat /sys/class/thermal/thermal_zone0/temp)
+  fi
+  if command -v vcgencmd > /dev/null; then
+    THROTTLED=$(( $(vcgencmd get_throttled | cut -d= -f2) ))
+  fi
+  echo "$(date +%s.%N) $(awk '
+    /^MemTotal:/ { mem_total = $2 } /^MemAvailable:/ { mem_available = $2 }
+    /^SwapTotal:/ { swap_total = $2 } /^SwapFree:/ { swap_free = $2 }
+    END { print mem_total - mem_available, swap_total - swap_free }' /proc/meminfo) $TEMP_MC $THROTTLED"
+}
+
+start_install_monitor() {
+  INSTALL_SAMPLES_FILE=$(mktemp)
+  INSTALL_STAGES_FILE=$(mktemp)
+  INSTALL_PHASES_FILE=$(mktemp)
+  while true; do
+    sample_install_resources >> $INSTALL_SAMPLES_FILE
+    sleep $INSTALL_MONITOR_INTERVAL
+  done &
+  INSTALL_MONITOR_PID=$!
+  trap stop_install EXIT
+}
+
+stop_install_monitor() {
+  if [ -n "$INSTALL_MONITOR_PID" ]; then
+    kill $INSTALL_MONITOR_PID 2> /dev/null
+    INSTALL_MONITOR_PID=
+  fi
+}
+
+# Stop the install monitor and the AVS SDK build staging when the script
+# exits, even if it is interrupted, so that the tmpfs or zram swap device of
+# the build does not hold on to the memory. The build results are discarded
+# if they cannot be copied out of the tmpfs.
+stop_install() {
+  stop_install_monitor
+  if [ -n "$BUILD_STAGING_TMPFS" ] || [ -n "$BUILD_STAGING_ZRAM" ]; then
+    if ! stop_build_staging && [ -n "$BUILD_STAGING_TMPFS" ]; then
+      echo "warning: discarding AVS SDK build results in tmpfs"
+      sudo umount $SDK_BUILD_DIR
+      BUILD_STAGING_TMPFS=
+    fi
+  fi
+}
+
+# Run an install stage, recording its wall time and exit status for the
+# install report
+run_stage() {
+  local NAME=$1
+  shift
+  local START=$(date +%s.%N)
+  "$@"
+  local STATUS=$?
+  echo "$NAME $START $(date +%s.%N) $STATUS" >> $INSTALL_STAGES_FILE
+  return $STATUS
+}
+
+# Record the start of each phase of the AVS setup.sh from the banners it
+# prints, such as "==============> CLONING SDK =============="
+record_avs_setup_phases() {
+  local LINE
+  while IFS= read -r LINE; do
+    if [[ "$LINE" =~ ^=+\>\ *(.*[^\ =])\ *=+$ ]]; then
+      echo "$(date +%s.%N) $(printf "%s" "${BASH_REMATCH[1]}" | tr 'A-Z' 'a-z' | tr -cs 'a-z0-9' '_')" >> $INSTALL_PHASES_FILE
+    fi
+  done
+}
+
+# Write the install report as JSON, with the wall time of each stage and
+# phase and the peak memory use, swap use, CPU temperature and throttle
+# state seen while it ran
+write_install_report() {
+  stop_install_monitor
+  awk -v samples=$INSTALL_SAMPLES_FILE -v phases=$INSTALL_PHASES_FILE -v interval=$INSTALL_MONITOR_INTERVAL \
+      -v device=$XMOS_DEVICE -v avs_device_sdk_tag=$AVS_DEVICE_SDK_TAG -v rpi_setup_tag=$RPI_SETUP_TAG \
+      -v model="$(tr -d '\0' 2> /dev/null < /proc/device-tree/model)" \
+      -v sd_card="$(cat /sys/block/mmcblk0/device/name /sys/block/mmcblk0/device/manfid 2> /dev/null | tr '\n' ' ' | sed 's/ $//')" \
+      -v cpus=$(nproc) -v mem_total_kb=$(awk '/^MemTotal:/ { print $2 }' /proc/meminfo) -v build_jobs="$BUILD_JOBS" '
+    function bitwise_or(a, b,    result, bit) {
+      result = 0
+      for (bit = 1; a > 0 || b > 0; bit *= 2) {
+        if (a % 2 == 1 || b % 2 == 1) {
+          result += bit
+        }
+        a = int(a / 2)
+        b = int(b / 2)
+      }
+      return result
+    }
+    function add_stage(stage_name, stage_start, stage_end, stage_status) {
+      stages++
+      name[stages] = stage_name
+      start[stages] = stage_start
+      end[stages] = stage_end
+      status[stages] = stage_status
+    }
+    FILENAME == samples { samples_count++; t[samples_count] = $1; mem[samples_count] = $2; swap[samples_count] = $3
+                          temp[samples_count] = $4; throttled[samples_count] = $5; next }
+    FILENAME == phases { phases_count++; phase_start[phases_count] = $1; phase_name[phases_count] = $2; next }
+    { add_stage($1, $2, $3, $4); if ($1 == "avs_setup") avs_setup_end = $3 }
+    END {
+      if (avs_setup_end == "") {
+        avs_setup_end = t[samples_count]
+      }
+      for (i = 1; i <= phases_count; i++) {
+        add_stage("avs_setup/" phase_name[i], phase_start[i], (i < phases_count ? phase_start[i + 1] : avs_setup_end), "null")
+      }
+      # Order the stages by start time, so that phases follow their stage
+      for (i = 2; i <= stages; i++) {
+        for (j = i; j > 1 && start[j] < start[j - 1]; j--) {
+          k = j - 1
+          swap_value = name[j]; name[j] = name[k]; name[k] = swap_value
+          swap_value = start[j]; start[j] = start[k]; start[k] = swap_value
+          swap_value = end[j]; end[j] = end[k]; end[k] = swap_value
+          swap_value = status[j]; status[j] = status[k]; status[k] = swap_value
+        }
+      }
+      printf "{\n"
+      printf "  \"device\": \"%s\",\n", device
+      printf "  \"avs_device_sdk_tag\": \"%s\",\n", avs_device_sdk_tag
+      printf "  \"rpi_setup_tag\": \"%s\",\n", rpi_setup_tag
+      printf "  \"model\": \"%s\",\n", model
+      printf "  \"sd_card\": \"%s\",\n", sd_card
+      printf "  \"cpus\": %d,\n", cpus
+      printf "  \"memory_kb\": %d,\n", mem_total_kb
+      printf "  \"build_jobs\": %s,\n", (build_jobs == "" ? "null" : build_jobs)
+      printf "  \"stages\": ["
+      for (i = 1; i <= stages; i++) {
+        peak_mem = ""; peak_swap = ""; peak_temp = ""; stage_throttled = 0; stage_samples = 0
+        for (j = 1; j <= samples_count; j++) {
+          if (t[j] < start[i] || t[j] > end[i] + interval) {
+            continue
+          }
+          stage_samples++
+          if (peak_mem == "" || mem[j] > peak_mem) peak_mem = mem[j]
+          if (peak_swap == "" || swap[j] > peak_swap) peak_swap = swap[j]
+          if (temp[j] != "-" && (peak_temp == "" || temp[j] > peak_temp)) peak_temp = temp[j]
+          stage_throttled = bitwise_or(stage_throttled, throttled[j])
+        }
+        printf "%s\n    {\n", (i > 1 ? "," : "")
+        printf "      \"name\": \"%s\",\n", name[i]
+        printf "      \"status\": %s,\n", status[i]
+        printf "      \"wall_time_s\": %.3f,\n", end[i] - start[i]
+        printf "      \"peak_memory_used_kb\": %s,\n", (peak_mem == "" ? "null" : peak_mem)
+        printf "      \"peak_swap_used_kb\": %s,\n", (peak_swap == "" ? "null" : peak_swap)
+        printf "      \"peak_cpu_temperature_c\": %s,\n", (peak_temp == "" ? "null" : sprintf("%.1f", peak_temp / 1000))
+        printf "      \"throttled\": %s\n", (stage_samples == 0 ? "null" : sprintf("\"0x%x\"", stage_throttled))
+        printf "    }"
+      }
+      printf "\n  ]\n}\n"
+    }' $INSTALL_SAMPLES_FILE $INSTALL_PHASES_FILE $INSTALL_STAGES_FILE > $INSTALL_REPORT_FILE
+  rm -f $INSTALL_SAMPLES_FILE $INSTALL_STAGES_FILE $INSTALL_PHASES_FILE
+  echo "Install report saved in $INSTALL_REPORT_FILE"
+}
+
+# Inputs of each install stage
+# The latency profile edits the ALSA configuration written by the Raspberry Pi
+# setup, so the setup is redone to restore it when the profile changes
+RPI_SETUP_STAGE_INPUTS="$RPI_SETUP_TAG $XMOS_DEVICE $LATENCY_PROFILE"
+AVS_SCRIPTS_STAGE_INPUTS="$AVS_DEVICE_SDK_TAG"
+AVS_SDK_STAGE_INPUTS="$AVS_DEVICE_SDK_TAG $XMOS_DEVICE $GPIO_KEY_WORD_DETECTOR_FLAG $HID_KEY_WORD_DETECTOR_FLAG ${CMAKE_EXTRA_ARGS[*]}"
+if [ -n "$ARTIFACT_LOCATION" ]; then
+  AVS_SDK_STAGE_INPUTS="$AVS_SDK_STAGE_INPUTS artifact"
+fi
+
+start_install_monitor
+
+# Layout of the SDK directory created by the AVS setup.sh, next to the
+# source and Sample App script directories of tools/avs_common.sh
+SDK_BUILD_DIR=$SDK_DIR/build
+SDK_DB_DIR=$SDK_DIR/db
+SDK_CONFIG_FILE=$SDK_BUILD_DIR/Integration/AlexaClientSDKConfig.json
+# List of the Debian packages needed to run a prebuilt artifact
+SDK_DEPENDENCIES_FILE=$SDK_DIR/dependencies.txt
+
+# Prebuilt artifacts are keyed by everything which changes the AVS SDK build
+ARTIFACT_NAME=avs-sdk-$AVS_DEVICE_SDK_TAG-rpi-setup-$RPI_SETUP_TAG-$XMOS_DEVICE
+if [ -n "$GPIO_KEY_WORD_DETECTOR_FLAG" ]; then
+  ARTIFACT_NAME=$ARTIFACT_NAME-gpio
+fi
+if [ -n "$HID_KEY_WORD_DETECTOR_FLAG" ]; then
+  ARTIFACT_NAME=$ARTIFACT_NAME-hid
+fi
+if [ -n "$HEADLESS" ]; then
+  ARTIFACT_NAME=$ARTIFACT_NAME-headless
+fi
+if [ -n "$FEATURE_ARGS" ]; then
+  ARTIFACT_NAME=$ARTIFACT_NAME-features-$(echo $FEATURE_ARGS | sha256sum | cut -c 1-8)
+fi
+ARTIFACT_NAME=$ARTIFACT_NAME.tar.gz
+
+# Amazon have changed the SDK directory structure. Prior versions will need to delete the directory before updating.
+# The SDK checkout and third-party trees only depend on the AVS SDK tag, so
+# an incremental install with other build inputs reconfigures the kept build
+# directory rather than starting again
+SDK_STATE=$(state_get avs_sdk)
+if [ -d $SDK_DIR ] && stage_is_current avs_sdk "$AVS_SDK_STAGE_INPUTS"; then
+  echo "Keep $SDK_DIR directory"
+elif [ -d $SDK_DIR ] && [ -n "$INCREMENTAL_INSTALL" ] && [ -z "$ARTIFACT_LOCATION" ] &&
+    [ "${SDK_STATE%% *}" == "$AVS_DEVICE_SDK_TAG" ] && [[ " $SDK_STATE " != *" artifact "* ]]; then
+  echo "Keep $SDK_DIR directory, reconfiguring the AVS SDK build"
+  state_set avs_sdk ""
+  rm -f $SDK_BUILD_DIR/CMakeCache.txt
+else
+  state_set avs_sdk ""
+  if [ -d $SDK_DIR ]; then
+    echo "Delete $SDK_DIR directory"
+    rm -rf $SDK_DIR
+  fi
+  mkdir $SDK_DIR
+fi
+
+if [ -n "$BUILD_ONLY" ]; then
+  echo "Skip VocalFusion ${XMOS_DEVICE:3} Raspberry Pi Setup"
+elif [ -d $RPI_SETUP_DIR ] && stage_is_current rpi_setup "$RPI_SETUP_STAGE_INPUTS"; then
+  echo "VocalFusion ${XMOS_DEVICE:3} Raspberry Pi Setup is up to date"
+  RPI_SETUP_IS_CURRENT=y
+else
+  state_set rpi_setup ""
+  if [ -d $RPI_SETUP_DIR ]; then
+    echo "Delete $RPI_SETUP_DIR directory"
+    rm -rf $RPI_SETUP_DIR
+  fi
+
+  run_stage rpi_setup_clone clone_tag https://github.com/xmos/$RPI_SETUP_REPO.git $RPI_SETUP_TAG $RPI_SETUP_DIR
+fi
+
+# Work out how many build jobs fit in the free memory, counting swap at half
+# its size and leaving room for the build directory staged in tmpfs to fill
+# up, without using more jobs than CPUs
+safe_build_jobs() {
+  local CPUS=$(nproc)
+  local MEM_AVAILABLE_KB=$(awk '/^MemAvailable:/ { print $2 }' /proc/meminfo)
+  local SWAP_FREE_KB=$(awk '/^SwapFree:/ { print $2 }' /proc/meminfo)
+  if [ -n "$BUILD_STAGING_TMPFS" ]; then
+    MEM_AVAILABLE_KB=$(( MEM_AVAILABLE_KB - $(df -k --output=avail $SDK_BUILD_DIR | tail -1) ))
+  fi
+  local JOBS=$(( (MEM_AVAILABLE_KB + SWAP_FREE_KB / 2) / BUILD_JOB_MEMORY_KB ))
+  if [[ $JOBS -gt $CPUS ]]; then
+    JOBS=$CPUS
+  fi
+  if [[ $JOBS -lt 1 ]]; then
+    JOBS=1
+  fi
+  echo $JOBS
+}
+
+# The AVS SDK scripts run make with a fixed number of jobs and CMake with
+# fixed options, so apply the build options of this script to the
+# downloaded copies. The CMake options are appended to the platform
+# specific options set by pi.sh, replacing those of any previous run.
+patch_avs_scripts() {
+  sed -i -E "s/(make[^#]*)-j *[0-9]+/\1-j$BUILD_JOBS/" $AVS_SCRIPT pi.sh
+  sed -i '/^# CMake options added by auto_install.sh$/,$d' pi.sh
+  if [ ${#CMAKE_EXTRA_ARGS[@]} -gt 0 ]; then
+    echo "# CMake options added by auto_install.sh" >> pi.sh
+    echo "CMAKE_PLATFORM_SPECIFIC+=(${CMAKE_EXTRA_ARGS[*]})" >> pi.sh
+  fi
+}
+
+# Set up ccache so that the cache can be shared by all devices building the
+# same AVS SDK, whatever their build directory
+setup_ccache() {
+  if ! command -v ccache > /dev/null; then
+    sudo apt-get install -y ccache
+  fi
+  export CCACHE_DIR
+  export CCACHE_BASEDIR=$SDK_DIR
+  export CCACHE_NOHASHDIR=1
+  export CCACHE_COMPILERCHECK=content
+  ccache --max-size=5G > /dev/null
+  ccache --zero-stats > /dev/null
+}
+
+# Download the AVS SDK install scripts
+download_avs_scripts() {
+  if stage_is_current avs_scripts "$AVS_SCRIPTS_STAGE_INPUTS" && [ -f $AVS_SCRIPT ] && [ -f pi.sh ] && [ -f genConfig.sh ]; then
+    echo "AVS SDK $AVS_DEVICE_SDK_TAG install scripts are up to date"
+    return 0
+  fi
+  state_set avs_scripts ""
+  run_stage download_$AVS_SCRIPT download https://raw.githubusercontent.com/xmos/avs-device-sdk/$AVS_DEVICE_SDK_TAG/tools/Install/$AVS_SCRIPT $AVS_SCRIPT &&
+  run_stage download_pi.sh download https://raw.githubusercontent.com/xmos/avs-device-sdk/$AVS_DEVICE_SDK_TAG/tools/Install/pi.sh pi.sh &&
+  run_stage download_genConfig.sh download https://raw.githubusercontent.com/xmos/avs-device-sdk/$AVS_DEVICE_SDK_TAG/tools/Install/genConfig.sh genConfig.sh &&
+  state_set avs_scripts "$AVS_SCRIPTS_STAGE_INPUTS"
+}
+
+# The AVS setup.sh only clones the AVS SDK if it is not already there, so
+# provide it with a shallow clone of the release tag
+clone_avs_sdk_source() {
+  if [ ! -d $SDK_SOURCE_DIR ]; then
+    run_stage avs_sdk_clone clone_tag https://github.com/xmos/avs-device-sdk.git $AVS_DEVICE_SDK_TAG $SDK_SOURCE_DIR
+  fi
+}
+
+# List the Debian packages installed by the AVS SDK install scripts
+avs_packages() {
+  sed -e ':a' -e '/\\$/N; s/\\\n//; ta' $AVS_SCRIPT pi.sh |
+    sed -e 's/#.*//' | grep -E '^\s*(sudo\s+)?apt(-get)?(\s.*)?\sinstall\s' |
+    sed -E 's/.*\sinstall\s//' | tr -s ' \t' '\n' |
+    grep -E '^[a-z0-9][a-z0-9.+-]+$' | sort -u
+}
+
+# Download the Debian packages needed by the AVS SDK install scripts into
+# the given directory. The package index is updated first, as the package
+# URIs of an outdated index are gone from the mirrors, into a copy of the
+# index in the given directory, so that neither the update nor the package
+# URIs printed by apt-get take the locks which may be held by the Raspberry
+# Pi setup.
+prefetch_avs_packages() {
+  local DIR=$1
+  local APT_OPTIONS="-o Dir::State::Lists=$DIR/lists -o Dir::Cache=$DIR/cache"
+  mkdir -p $DIR/lists/partial $DIR/cache/archives/partial
+  apt-get $APT_OPTIONS update --allow-releaseinfo-change -qq || return 1
+  apt-get $APT_OPTIONS install --print-uris -qq -y $(avs_packages) |
+    while read URI FILE SIZE HASH; do
+      download ${URI//\'/} $DIR/$FILE
+    done
+}
+
+# Download everything needed to install the AVS SDK
+prefetch_avs_sdk() {
+  local DIR=$1
+  download_avs_scripts || return 1
+  if [ -z "$ARTIFACT_LOCATION" ]; then
+    clone_avs_sdk_source &&
+    run_stage prefetch_packages prefetch_avs_packages $DIR
+  fi
+}
+
+# Wait for the background downloads of the pipelined install, and hand the
+# downloaded packages over to apt
+finish_prefetch() {
+  local DIR=$1
+  local PID=$2
+  echo "Waiting for AVS SDK downloads to complete..."
+  if ! wait $PID; then
+    echo "warning: AVS SDK downloads failed, see $PREFETCH_LOG"
+    rm -rf $DIR
+    return 1
+  fi
+  if ls $DIR/*.deb > /dev/null 2>&1; then
+    sudo cp $DIR/*.deb /var/cache/apt/archives/
+  fi
+  rm -rf $DIR
+}
+
+# Run the AVS setup.sh, recording its phases for the install report
+run_avs_setup() {
+  $AVS_CMD | tee >(record_avs_setup_phases)
+  return ${PIPESTATUS[0]}
+}
+
+# Stage the AVS SDK build directory in tmpfs, sized to half of the memory,
+# or add a zram swap device the size of the memory for the build. An
+# existing build directory is copied into tmpfs for an incremental build.
+start_build_staging() {
+  local MEM_TOTAL_KB=$(awk '/^MemTotal:/ { print $2 }' /proc/meminfo)
+  local STAGED_DIR=$SDK_DIR/build.staged
+  if [[ $MEM_TOTAL_KB -ge $BUILD_TMPFS_MIN_MEMORY_KB ]]; then
+    echo "Building AVS SDK in tmpfs"
+    rm -rf $STAGED_DIR
+    if [ -d $SDK_BUILD_DIR ]; then
+      mv $SDK_BUILD_DIR $STAGED_DIR
+    fi
+    mkdir -p $SDK_BUILD_DIR
+    if ! sudo mount -t tmpfs -o size=$(( MEM_TOTAL_KB / 2 ))k,uid=$(id -u),gid=$(id -g),mode=755 avs-sdk-build $SDK_BUILD_DIR; then
+      rmdir $SDK_BUILD_DIR
+      if [ -d $STAGED_DIR ]; then
+        mv $STAGED_DIR $SDK_BUILD_DIR
+      fi
+      return 1
+    fi
+    BUILD_STAGING_TMPFS=y
+    if [ -d $STAGED_DIR ]; then
+      cp -a $STAGED_DIR/. $SDK_BUILD_DIR && rm -rf $STAGED_DIR
+    fi
+  else
+    echo "Building AVS SDK with zram swap"
+    sudo modprobe zram &&
+    BUILD_STAGING_ZRAM=$(sudo zramctl --find --size ${MEM_TOTAL_KB}KiB --algorithm lz4) &&
+    sudo mkswap $BUILD_STAGING_ZRAM > /dev/null &&
+    sudo swapon -p 100 $BUILD_STAGING_ZRAM
+  fi
+}
+
+# Copy the AVS SDK build results from tmpfs to the SD card, leaving out the
+# object files unless they are needed by the next incremental install, or
+# remove the zram swap device
+stop_build_staging() {
+  local STAGED_DIR=$SDK_DIR/build.staged
+  local EXCLUDE_ARGS=--exclude=*.o
+  if [ -n "$INCREMENTAL_INSTALL" ]; then
+    EXCLUDE_ARGS=
+  fi
+  if [ -n "$BUILD_STAGING_TMPFS" ]; then
+    echo "Copying AVS SDK build results to $SDK_BUILD_DIR"
+    rm -rf $STAGED_DIR
+    mkdir -p $STAGED_DIR
+    tar -c -C $SDK_BUILD_DIR $EXCLUDE_ARGS . | tar -x -C $STAGED_DIR
+    if [ "${PIPESTATUS[*]}" != "0 0" ]; then
+      echo "error: cannot copy AVS SDK build results to $SDK_BUILD_DIR"
+      rm -rf $STAGED_DIR
+      return 1
+    fi
+    sudo umount $SDK_BUILD_DIR &&
+    rm -rf $SDK_BUILD_DIR &&
+    mv $STAGED_DIR $SDK_BUILD_DIR || return 1
+    BUILD_STAGING_TMPFS=
+  elif [ -n "$BUILD_STAGING_ZRAM" ]; then
+    sudo swapoff $BUILD_STAGING_ZRAM
+    sudo zramctl --reset $BUILD_STAGING_ZRAM
+    BUILD_STAGING_ZRAM=
+  fi
+}
+
+# Build and configure the AVS SDK from source with the AVS setup.sh
+build_avs_sdk() {
+  chmod +x $AVS_SCRIPT
+  # The number of build jobs depends on the swap added for the build
+  if [ -n "$BUILD_STAGING" ] && ! run_stage build_staging start_build_staging; then
+    echo "warning: cannot build AVS SDK in memory, building on the SD card"
+    stop_build_staging
+  fi
+  if [ -z "$BUILD_JOBS" ]; then
+    BUILD_JOBS=$(safe_build_jobs)
+  fi
+  echo "Building AVS SDK with $BUILD_JOBS parallel jobs"
+  patch_avs_scripts
+  export MAKEFLAGS="-j$BUILD_JOBS"
+  export CMAKE_BUILD_PARALLEL_LEVEL=$BUILD_JOBS
+  if [ -n "$CCACHE_DIR" ]; then
+    echo "Compiling AVS SDK through ccache with cache in $CCACHE_DIR"
+    setup_ccache
+  fi
+  clone_avs_sdk_source
+  AVS_CMD="./${AVS_SCRIPT} ${CONFIG_JSON_FILE} ${AVS_DEVICE_SDK_TAG} -s ${DEVICE_SERIAL_NUMBER} -x ${XMOS_DEVICE} ${GPIO_KEY_WORD_DETECTOR_FLAG} ${HID_KEY_WORD_DETECTOR_FLAG}"
+  echo "Running command ${AVS_CMD}"
+  if ! run_stage avs_setup run_avs_setup; then
+    stop_build_staging
+    return 1
+  fi
+  run_stage build_staging_copy stop_build_staging || return 1
+  if [ -n "$CCACHE_DIR" ]; then
+    ccache --show-stats
+  fi
+}
+
+# Fetch the prebuilt artifact and its checksum into the given directory. The
+# artifact can be rebuilt at the same URL, so its checksum is always
+# downloaded and the artifact is looked up in the cache by its checksum.
+fetch_avs_artifact() {
+  local DIR=$1
+  if [[ "$ARTIFACT_LOCATION" =~ ^https?:// ]]; then
+    wget -O $DIR/$ARTIFACT_NAME.sha256 $ARTIFACT_LOCATION/$ARTIFACT_NAME.sha256 &&
+    download $ARTIFACT_LOCATION/$ARTIFACT_NAME $DIR/$ARTIFACT_NAME $(cut -d' ' -f1 $DIR/$ARTIFACT_NAME.sha256)
+  else
+    cp "$ARTIFACT_LOCATION/$ARTIFACT_NAME" "$ARTIFACT_LOCATION/$ARTIFACT_NAME.sha256" $DIR
+  fi
+}
+
+# Install the AVS SDK from a prebuilt artifact, after checking it against
+# its checksum
+install_avs_artifact() {
+  local DIR=$(mktemp -d)
+  echo "Fetching prebuilt AVS SDK $ARTIFACT_NAME from $ARTIFACT_LOCATION"
+  if ! fetch_avs_artifact $DIR; then
+    echo "error: cannot fetch prebuilt AVS SDK $ARTIFACT_NAME."
+    rm -rf $DIR
+    return 1
+  fi
+  if ! ( cd $DIR && sha256sum -c $ARTIFACT_NAME.sha256 ); then
+    echo "error: checksum of prebuilt AVS SDK $ARTIFACT_NAME does not match."
+    rm -rf $DIR
+    return 1
+  fi
+  rm -rf $SDK_DIR
+  if ! tar -xzf $DIR/$ARTIFACT_NAME -C $HOME; then
+    echo "error: cannot extract prebuilt AVS SDK $ARTIFACT_NAME."
+    rm -rf $DIR $SDK_DIR
+    return 1
+  fi
+  rm -rf $DIR
+  if [ -f $SDK_DEPENDENCIES_FILE ]; then
+    sudo apt-get install -y $(cat $SDK_DEPENDENCIES_FILE)
+  fi
+}
+
+# Generate the AVS SDK configuration for this device, as done by the AVS
+# setup.sh after the build
+generate_avs_config() {
+  local TEMP_CONFIG_FILE=$(mktemp)
+  mkdir -p $SDK_DB_DIR $(dirname $SDK_CONFIG_FILE)
+  cat << EOF > $SDK_CONFIG_FILE
+ {
+    "gstreamerMediaPlayer":{
+        "audioSink":"alsasink"
+    },
+EOF
+  if ! bash genConfig.sh $CONFIG_JSON_FILE $DEVICE_SERIAL_NUMBER $SDK_DB_DIR $SDK_SOURCE_DIR $TEMP_CONFIG_FILE \
+      -DSDK_CONFIG_MANUFACTURER_NAME="XMOS" -DSDK_CONFIG_DEVICE_DESCRIPTION="raspberrypi"; then
+    rm -f $TEMP_CONFIG_FILE
+    return 1
+  fi
+  # Remove the opening bracket of the generated configuration
+  sed -e "1d" $TEMP_CONFIG_FILE >> $SDK_CONFIG_FILE
+  rm -f $TEMP_CONFIG_FILE
+  if ! grep -q "alias avsrun=" $HOME/.bashrc; then
+    echo "alias avsrun=\"$AVSRUN_SCRIPT\"" >> $HOME/.bashrc
+  fi
+}
+
+# Create a prebuilt artifact of the AVS SDK build, leaving out the
+# intermediate build files and the databases holding this device's
+# registration
+create_avs_artifact() {
+  echo "Creating prebuilt AVS SDK $ARTIFACT_NAME in $ARTIFACT_OUTPUT_DIR"
+  # Record the packages providing the shared libraries used by the build
+  find $SDK_BUILD_DIR -type f \( -name "*.so*" -o -name SampleApp \) -exec ldd {} + 2> /dev/null |
+    awk '$2 == "=>" && $3 ~ /^\// { print $3 }' | sort -u |
+    xargs -r dpkg -S 2> /dev/null | cut -d: -f1 | sort -u > $SDK_DEPENDENCIES_FILE
+  tar -czf $ARTIFACT_OUTPUT_DIR/$ARTIFACT_NAME -C $HOME \
+    --exclude="$(basename $SDK_DIR)/$(basename $SDK_DB_DIR)" --exclude=.git --exclude=CMakeFiles --exclude="*.o" \
+    $(basename $SDK_DIR) &&
+  ( cd $ARTIFACT_OUTPUT_DIR && sha256sum $ARTIFACT_NAME > $ARTIFACT_NAME.sha256 )
+}
+
+# Set the period and buffer sizes of the latency profile in the slave of
+# each dmix and dsnoop PCM of the ALSA configuration written by the
+# Raspberry Pi setup, replacing the sizes already set. The slave can be a
+# slave block or slave.pcm with dotted keys. The capture buffer depth of the
+# profile is not written into the AVS SDK configuration if no PCM was
+# changed.
+configure_alsa_latency() {
+  local ASOUNDRC=$HOME/.asoundrc
+  local TEMP_FILE=
+  local COUNT_FILE=
+  local CHANGED_PCMS=
+  if [ ! -f $ASOUNDRC ]; then
+    echo "warning: $ASOUNDRC not found, ALSA latency profile not applied."
+    return 0
+  fi
+  echo "Applying $LATENCY_PROFILE latency profile to $ASOUNDRC: $ALSA_PERIODS periods of ${ALSA_PERIOD_TIME_US}us"
+  TEMP_FILE=$(mktemp)
+  COUNT_FILE=$(mktemp)
+  awk -v period_time=$ALSA_PERIOD_TIME_US -v periods=$ALSA_PERIODS -v count_file=$COUNT_FILE '
+    function update_depth(line,    opened, closed) {
+      opened = gsub(/{/, "{", line)
+      closed = gsub(/}/, "}", line)
+      depth += opened - closed
+      return opened - closed
+    }
+    # Find the dmix and dsnoop PCMs
+    NR == FNR {
+      if (depth == 0 && match($0, /pcm\.[^ \t{]+/)) {
+        pcm = substr($0, RSTART, RLENGTH)
+      }
+      if (pcm != "" && $0 ~ /^[ \t]*type[ \t]+(dmix|dsnoop)/) {
+        direct[pcm] = 1
+      }
+      update_depth($0)
+      if (depth == 0) {
+        pcm = ""
+      }
+      next
+    }
+    FNR == 1 {
+      depth = 0
+      pcm = ""
+    }
+    {
+      if (depth == 0 && match($0, /pcm\.[^ \t{]+/)) {
+        pcm = substr($0, RSTART, RLENGTH)
+      }
+      if (slave_depth && $0 ~ /^[ \t]*(period_time|period_size|buffer_time|buffer_size|periods)[ \t]/) {
+        next
+      }
+      if (direct[pcm] && depth == 1 && $0 ~ /^[ \t]*slave\.(period_time|period_size|buffer_time|buffer_size|periods)[ \t]/) {
+        next
+      }
+      print
+      if (direct[pcm] && depth == 1 && $0 ~ /^[ \t]*slave\.pcm[ \t]/) {
+        changed[pcm] = 1
+        print "    slave.period_time " period_time
+        print "    slave.buffer_time " period_time * periods
+      }
+      if (update_depth($0) > 0 && direct[pcm] && $0 ~ /slave[ \t]*{/) {
+        changed[pcm] = 1
+        slave_depth = depth
+        print "    period_time " period_time
+        print "    buffer_time " period_time * periods
+      }
+      if (depth < slave_depth) {
+        slave_depth = 0
+      }
+      if (depth == 0) {
+        pcm = ""
+      }
+    }
+    END {
+      for (pcm in changed) {
+        changed_count++
+      }
+      print changed_count + 0 > count_file
+    }' $ASOUNDRC $ASOUNDRC > $TEMP_FILE
+  cat $TEMP_FILE > $ASOUNDRC
+  CHANGED_PCMS=$(cat $COUNT_FILE)
+  rm -f $TEMP_FILE $COUNT_FILE
+  if [ "$CHANGED_PCMS" == 0 ]; then
+    echo "warning: no dmix or dsnoop PCM found in $ASOUNDRC, ALSA latency profile not applied."
+    if [ -n "$CAPTURE_BUFFER_FROM_PROFILE" ]; then
+      CAPTURE_BUFFER_MS=
+    fi
+  fi
+}
+
+# Remove the vocalfusion_comms PCM added by a previous install
+remove_comms_pcm() {
+  if [ -f $HOME/.asoundrc ]; then
+    sed -i '/^# Begin comms PCM added by auto_install.sh$/,/^# End comms PCM added by auto_install.sh$/d' $HOME/.asoundrc
+  fi
+}
+
+# Add a PCM to the ALSA configuration written by the Raspberry Pi setup,
+# which reads the comms channel from the dsnoop PCM the AVS SDK captures
+# from. Both then share the same capture buffer, without opening the device
+# a second time.
+configure_comms_pcm() {
+  local ASOUNDRC=$HOME/.asoundrc
+  local DSNOOP=
+  local CHANNELS=
+  if [ -f $ASOUNDRC ]; then
+    read DSNOOP CHANNELS < <(awk '
+      depth == 0 && match($0, /pcm\.[^ \t{]+/) { pcm = substr($0, RSTART + 4, RLENGTH - 4) }
+      pcm != "" && $0 ~ /^[ \t]*type[ \t]+dsnoop/ { dsnoop = pcm }
+      dsnoop != "" && dsnoop == pcm && $1 == "channels" { channels = $2 }
+      { depth += gsub(/{/, "{") - gsub(/}/, "}"); if (depth == 0) pcm = "" }
+      END { if (dsnoop != "") print dsnoop, channels == "" ? 2 : channels }' $ASOUNDRC)
+  fi
+  if [ -z "$DSNOOP" ]; then
+    echo "warning: no dsnoop capture PCM found in $ASOUNDRC, vocalfusion_comms PCM not added."
+    return 0
+  fi
+  echo "Adding vocalfusion_comms PCM reading channel $COMMS_CHANNEL of $DSNOOP to $ASOUNDRC"
+  cat << EOF >> $ASOUNDRC
+# Begin comms PCM added by auto_install.sh
+pcm.vocalfusion_comms {
+  type plug
+  slave.pcm {
+    type route
+    slave.pcm "$DSNOOP"
+    slave.channels $CHANNELS
+    ttable.0.$COMMS_CHANNEL 1
+  }
+}
+# End comms PCM added by auto_install.sh
+EOF
+}
+
+# Apply the audio and headless options of this script to the generated AVS
+# SDK configuration
+configure_avs_sdk() {
+  local FILTER=.
+  local TEMP_CONFIG_FILE=
+  if [ -n "$CAPTURE_BUFFER_MS" ]; then
+    FILTER="$FILTER | .sampleApp.portAudio.suggestedLatency = $(awk -v ms=$CAPTURE_BUFFER_MS 'BEGIN { print ms / 1000 }')"
+  fi
+  # There is no display for the cards of a headless install
+  if [ -n "$HEADLESS" ]; then
+    FILTER="$FILTER | .sampleApp.displayCardsSupported = false"
+  fi
+  if [ "$FILTER" == . ]; then
+    return 0
+  fi
+  if [ ! -f $SDK_CONFIG_FILE ]; then
+    echo "error: AVS SDK configuration $SDK_CONFIG_FILE not found."
+    return 1
+  fi
+  if ! command -v jq > /dev/null; then
+    sudo apt-get install -y jq
+  fi
+  # The configuration generated from the SDK template has comment lines,
+  # which the SDK accepts but jq does not
+  TEMP_CONFIG_FILE=$(mktemp)
+  if ! sed -e '/^[[:space:]]*\/\//d' $SDK_CONFIG_FILE | jq "$FILTER" > $TEMP_CONFIG_FILE; then
+    rm -f $TEMP_CONFIG_FILE
+    return 1
+  fi
+  cat $TEMP_CONFIG_FILE > $SDK_CONFIG_FILE
+  rm -f $TEMP_CONFIG_FILE
+}
+
+# Install the systemd services starting the Sample App at boot as soon as
+# the sound card is ready, and preloading its files while the rest of the
+# system starts. The Sample App reads commands from its input, so it is
+# given an input which stays open.
+install_fast_boot() {
+  echo "Installing avsrun service to start the Sample App at boot"
+  sudo tee /etc/systemd/system/avsrun-preload.service > /dev/null << EOF
+[Unit]
+Description=Preload the AVS SDK Sample App
+DefaultDependencies=no
+After=local-fs.target
+
+[Service]
+Type=oneshot
+User=$USER
+ExecStart=$SETUP_DIR/tools/avs_preload.sh
+
+[Install]
+WantedBy=sysinit.target
+EOF
+  sudo tee /etc/systemd/system/avsrun.service > /dev/null << EOF
+[Unit]
+Description=AVS SDK Sample App
+Wants=sound.target avsrun-preload.service
+After=sound.target
+
+[Service]
+User=$USER
+WorkingDirectory=$HOME
+Environment=MALLOC_ARENA_MAX=$SAMPLE_APP_MALLOC_ARENA_MAX
+ExecStart=/bin/sh -c "tail -f /dev/null | $AVSRUN_SCRIPT"
+Restart=on-failure
+
+[Install]
+WantedBy=multi-user.target
+EOF
+  # Do not start a second Sample App from the desktop session
+  if [ -f $DESKTOP_AUTOSTART_FILE ]; then
+    sed -i "\|$(basename $AVSRUN_SCRIPT)|d" $DESKTOP_AUTOSTART_FILE
+  fi
+  # Remove the drop-ins of a previous install which are not selected
+  if [ -z "$CPU_RESERVATION" ]; then
+    sudo rm -f /etc/systemd/system/avsrun.service.d/cpu-reservation.conf
+  fi
+  if [ -z "$LOW_POWER_IDLE" ]; then
+    sudo rm -f /etc/systemd/system/avsrun.service.d/low-power.conf
+  fi
+  sudo systemctl daemon-reload &&
+  sudo systemctl enable avsrun-preload.service avsrun.service
+}
+
+# Remove the avsrun services of a previous install, so that the Sample App
+# started from the desktop session is the only one using the sound card
+remove_fast_boot() {
+  if [ ! -f /etc/systemd/system/avsrun.service ] && [ ! -f /etc/systemd/system/avsrun-preload.service ]; then
+    return 0
+  fi
+  echo "Removing avsrun service of a previous install"
+  sudo systemctl disable --now avsrun.service avsrun-preload.service 2> /dev/null
+  sudo rm -rf /etc/systemd/system/avsrun.service /etc/systemd/system/avsrun-preload.service /etc/systemd/system/avsrun.service.d
+  sudo systemctl daemon-reload
+}
+
+# Keep the other processes and the interrupts off the last CPU, and run the
+# Sample App of the avsrun service on all CPUs, so that the last CPU is only
+# shared by the Sample App threads. The threads keep the normal scheduling
+# policy, as the audio threads cannot be told apart from the network and
+# audio decoding threads from outside the Sample App.
+install_cpu_reservation() {
+  local CMDLINE=
+  echo "Reserving CPU $RESERVED_CPU for the avsrun service"
+  sudo mkdir -p /etc/systemd/system/avsrun.service.d /etc/systemd/system.conf.d
+  sudo tee /etc/systemd/system/avsrun.service.d/cpu-reservation.conf > /dev/null << EOF
+[Service]
+CPUAffinity=0-$RESERVED_CPU
+EOF
+  sudo tee /etc/systemd/system.conf.d/avs-cpu-reservation.conf > /dev/null << EOF
+[Manager]
+CPUAffinity=0-$(( RESERVED_CPU - 1 ))
+EOF
+  # Keep the interrupts, such as those of the network, off the last CPU
+  if [ -f $BOOT_CMDLINE_FILE ]; then
+    CMDLINE=$(sed -E 's/ *irqaffinity=[^ ]*//' $BOOT_CMDLINE_FILE)
+    echo "$CMDLINE irqaffinity=0-$(( RESERVED_CPU - 1 ))" | sudo tee $BOOT_CMDLINE_FILE > /dev/null
+  fi
+  sudo systemctl daemon-reload
+}
+
+# Give the CPU kept for the Sample App back to the other processes and the
+# interrupts, if it was reserved by a previous install
+remove_cpu_reservation() {
+  local CMDLINE=
+  if [ ! -f /etc/systemd/system.conf.d/avs-cpu-reservation.conf ]; then
+    return 0
+  fi
+  echo "Removing CPU reservation of a previous install"
+  sudo rm -f /etc/systemd/system.conf.d/avs-cpu-reservation.conf /etc/systemd/system/avsrun.service.d/cpu-reservation.conf
+  if [ -f $BOOT_CMDLINE_FILE ]; then
+    CMDLINE=$(sed -E 's/ *irqaffinity=[^ ]*//' $BOOT_CMDLINE_FILE)
+    echo "$CMDLINE" | sudo tee $BOOT_CMDLINE_FILE > /dev/null
+  fi
+  sudo systemctl daemon-reload
+}
+
+# Run the Sample App of the avsrun service with a timer slack, so that the
+# timer wakeups of its threads are grouped while it waits for the keyword
+install_low_power_idle() {
+  echo "Installing low-power idle mode for the avsrun service"
+  sudo mkdir -p /etc/systemd/system/avsrun.service.d
+  sudo tee /etc/systemd/system/avsrun.service.d/low-power.conf > /dev/null << EOF
+[Service]
+TimerSlackNSec=$IDLE_TIMER_SLACK_NS
+EOF
+  sudo systemctl daemon-reload
+}
+
+# Install the service exporting the Sample App metrics, which can read the
+# journal of the avsrun service
+install_metrics_service() {
+  echo "Installing avs-metrics service to export the Sample App metrics"
+  sudo tee /etc/systemd/system/avs-metrics.service > /dev/null << EOF
+[Unit]
+Description=AVS SDK Sample App metrics
+After=avsrun.service
+
+[Service]
+User=$USER
+SupplementaryGroups=systemd-journal
+ExecStart=$SETUP_DIR/tools/avs_metrics.sh
+Restart=on-failure
+
+[Install]
+WantedBy=multi-user.target
+EOF
+  sudo systemctl daemon-reload &&
+  sudo systemctl enable avs-metrics.service
+}
+
+# Add the aliases for the tools run against the Sample App
+install_tool_aliases() {
+  local ALIAS
+  for ALIAS in $TOOL_ALIASES; do
+    if ! grep -q "alias ${ALIAS%%=*}=" $HOME/.bashrc; then
+      echo "alias ${ALIAS%%=*}=\"$SETUP_DIR/tools/${ALIAS#*=}\"" >> $HOME/.bashrc
+    fi
+  done
+}
+
+# Install the AVS SDK, from a prebuilt artifact if one is given
+install_avs_sdk() {
+  if [ -z "$ARTIFACT_LOCATION" ]; then
+    build_avs_sdk
+  elif stage_is_current avs_sdk "$AVS_SDK_STAGE_INPUTS"; then
+    run_stage avs_config generate_avs_config
+  else
+    run_stage avs_artifact_install install_avs_artifact &&
+    run_stage avs_config generate_avs_config
+  fi
+}
+
+# Download the AVS SDK in the background while the Raspberry Pi is set up
+if [ -n "$PIPELINED_INSTALL" ]; then
+  PREFETCH_DIR=$(mktemp -d)
+  echo "Downloading AVS SDK in the background, see $PREFETCH_LOG"
+  run_stage prefetch prefetch_avs_sdk $PREFETCH_DIR > $PREFETCH_LOG 2>&1 &
+  PREFETCH_PID=$!
+fi
+
+# Execute (rather than source) the setup scripts, exiting with the status of
+# the install
+INSTALL_STATUS=1
+if [ -z "$BUILD_ONLY" ]; then
+  echo "Installing VocalFusion ${XMOS_DEVICE:3} Raspberry Pi Setup..."
+fi
+if [ -n "$BUILD_ONLY" ] || [ -n "$RPI_SETUP_IS_CURRENT" ] || run_stage rpi_setup $RPI_SETUP_SCRIPT $XMOS_DEVICE; then
+  AVS_SCRIPTS_ARE_PREFETCHED=
+  if [ -n "$PREFETCH_PID" ] && finish_prefetch $PREFETCH_DIR $PREFETCH_PID; then
+    AVS_SCRIPTS_ARE_PREFETCHED=y
+  fi
+  if [ -z "$BUILD_ONLY" ]; then
+    state_set rpi_setup "$RPI_SETUP_STAGE_INPUTS"
+  fi
+  if [ -n "$LATENCY_PROFILE" ] && [ -z "$BUILD_ONLY" ]; then
+    configure_alsa_latency
+  fi
+  if [ -z "$BUILD_ONLY" ]; then
+    remove_comms_pcm
+  fi
+  if [ -n "$COMMS_PCM" ] && [ -z "$BUILD_ONLY" ]; then
+    configure_comms_pcm
+  fi
 
   # The line below is needed to avoid the error:
   # E: Repository 'http://raspbian.raspberrypi.org/raspbian buster InRelease' changed its 'Suite' value from 'testing' to 'stable'
   # N: This must be accepted explicitly before updates for this repository can be applied. See apt-secure(8) manpage for details.
-  sudo apt update --allow-releaseinfo-change
+  run_stage apt_update sudo apt update --allow-releaseinfo-change
   echo "Installing Amazon AVS SDK..."
-  wget -O $AVS_SCRIPT https://raw.githubusercontent.com/xmos/avs-device-sdk/$AVS_DEVICE_SDK_TAG/tools/Install/$AVS_SCRIPT
-  wget -O pi.sh https://raw.githubusercontent.com/xmos/avs-device-sdk/$AVS_DEVICE_SDK_TAG/tools/Install/pi.sh
-  wget -O genConfig.sh https://raw.githubusercontent.com/xmos/avs-device-sdk/$AVS_DEVICE_SDK_TAG/tools/Install/genConfig.sh
-  chmod +x $AVS_SCRIPT
-AVS_CMD="./${AVS_SCRIPT} ${CONFIG_JSON_FILE} ${AVS_DEVICE_SDK_TAG} -s ${DEVICE_SERIAL_NUMBER} -x ${XMOS_DEVICE} ${GPIO_KEY_WORD_DETECTOR_FLAG} ${HID_KEY_WORD_DETECTOR_FLAG}"
-echo "Running command ${AVS_CMD}"
-  if $AVS_CMD; then
-    echo "Type 'sudo reboot' below to reboot the Raspberry Pi and complete the AVS setup."
+  if { [ -n "$AVS_SCRIPTS_ARE_PREFETCHED" ] || download_avs_scripts; } && install_avs_sdk &&
+      run_stage avs_config_options configure_avs_sdk; then
+    state_set avs_sdk "$AVS_SDK_STAGE_INPUTS"
+    INSTALL_STATUS=0
+    install_tool_aliases
+    if [ -n "$FAST_BOOT" ] && [ -z "$BUILD_ONLY" ]; then
+      run_stage fast_boot install_fast_boot || INSTALL_STATUS=1
+    elif [ -z "$BUILD_ONLY" ]; then
+      remove_fast_boot
+    fi
+    if [ -n "$CPU_RESERVATION" ] && [ -z "$BUILD_ONLY" ]; then
+      run_stage cpu_reservation install_cpu_reservation || INSTALL_STATUS=1
+    elif [ -z "$BUILD_ONLY" ]; then
+      remove_cpu_reservation
+    fi
+    if [ -n "$LOW_POWER_IDLE" ] && [ -z "$BUILD_ONLY" ]; then
+      run_stage low_power_idle install_low_power_idle || INSTALL_STATUS=1
+    fi
+    if [ -n "$METRICS_SERVICE" ] && [ -z "$BUILD_ONLY" ]; then
+      run_stage metrics_service install_metrics_service || INSTALL_STATUS=1
+    fi
+    # Leave the memory used by the desktop session to other applications
+    if [ -n "$HEADLESS" ] && [ -z "$BUILD_ONLY" ]; then
+      sudo systemctl set-default multi-user.target
+    fi
+    if [ -n "$ARTIFACT_OUTPUT_DIR" ]; then
+      run_stage avs_artifact_create create_avs_artifact || INSTALL_STATUS=1
+    fi
+    if [ -z "$BUILD_ONLY" ]; then
+      echo "Type 'sudo reboot' below to reboot the Raspberry Pi and complete the AVS setup."
+    fi
   fi
+elif [ -n "$PREFETCH_PID" ]; then
+  kill $PREFETCH_PID 2> /dev/null
+  rm -rf $PREFETCH_DIR
 fi
 
+write_install_report
+
 popd > /dev/null
+if [ $INSTALL_STATUS -ne 0 ]; then
+  echo "error: the install failed, see $INSTALL_REPORT_FILE"
+fi
+exit $INSTALL_STATUS
@@ -0,0 +1,209 @@
+#!/usr/bin/env bash
+# Copyright 2021 XMOS LIMITED. This software is subject to the terms of the
+# XMOS Public Licence, Version 1
+pushd "$( dirname "${BASH_SOURCE[0]}" )" > /dev/null
+SETUP_DIR="$( pwd )"
+
+# Default Raspberry Pi OS architecture to build for
+TARGET_ARCH=armhf
+# Container platform and base image of each architecture, with the same
+# userland as Raspberry Pi OS
+TARGET_PLATFORMS="
+  armhf:linux/arm:balenalib/raspberry-pi-debian:buster
+  aarch64:linux/arm64:balenalib/raspberrypi3-64-debian:buster
+"
+BASE_IMAGE=
+# Home directory of the Raspberry Pi user the artifact is built for
+TARGET_HOME=/home/pi
+# Disable compiler cache and download cache by default
+CCACHE_DIR=
+DOWNLOAD_CACHE_DIR=
+# Files of the setup copied into the container
+SETUP_FILES="auto_install.sh config.json tools"
+
+usage() {
+  cat <<EOT
+usage: cross_build.sh <DEVICE-TYPE> <OUTPUT-DIR> [OPTIONS] [-- INSTALL-OPTIONS]
+
+Build the AVS SDK for a Raspberry Pi on another host, such as an x86_64
+workstation, and save it as a prebuilt artifact in the OUTPUT-DIR, to be
+installed on the Raspberry Pis with the auto_install.sh option -b.
+
+The AVS SDK is built by auto_install.sh, without the Raspberry Pi setup, in
+a Docker container with the Raspberry Pi OS userland, run through QEMU
+user emulation when the host is not an ARM host. The INSTALL-OPTIONS, such
+as -G, -H, -n or -F, are passed to auto_install.sh and must be the same as
+the options given to auto_install.sh on the Raspberry Pis.
+
+Optional parameters:
+  -a <arch>           Raspberry Pi OS architecture: armhf or aarch64, default
+                      is $TARGET_ARCH
+  -c <cache-dir>      Compile the AVS SDK through ccache, keeping the cache
+                      in the given directory
+  -d <cache-dir>      Keep the downloaded files and repositories in the given
+                      directory
+  -I <image>          Base image of the container, default is the Raspberry
+                      Pi OS userland of the architecture
+  -u <home-dir>       Home directory of the user installing the artifact on
+                      the Raspberry Pis, default is $TARGET_HOME
+  -h                  Display this help and exit
+EOT
+}
+
+if [ $# -lt 2 ] || [ $1 == '-h' ]; then
+    usage
+    exit 1
+fi
+
+XMOS_DEVICE=$1
+OUTPUT_DIR=$2
+shift 2
+
+OPTIONS=a:c:d:I:u:h
+while getopts "$OPTIONS" opt ; do
+    case $opt in
+        a )
+            TARGET_ARCH="$OPTARG"
+            ;;
+        c )
+            CCACHE_DIR="$OPTARG"
+            ;;
+        d )
+            DOWNLOAD_CACHE_DIR="$OPTARG"
+            ;;
+        I )
+            BASE_IMAGE="$OPTARG"
+            ;;
+        u )
+            TARGET_HOME="$OPTARG"
+            ;;
+        h )
+            usage
+            exit 1
+            ;;
+    esac
+done
+shift $(( OPTIND - 1 ))
+INSTALL_ARGS=("$@")
+
+if ! command -v docker > /dev/null; then
+  echo "error: docker not found."
+  exit 1
+fi
+
+if [ ! -f config.json ]; then
+  echo "error: config JSON file not found."
+  echo
+  usage
+  exit 1
+fi
+
+# Print the container platform and base image of an architecture
+target_platform() {
+  local SETTINGS
+  for SETTINGS in $TARGET_PLATFORMS; do
+    if [[ "$SETTINGS" == "$1:"* ]]; then
+      echo "${SETTINGS#$1:}" | sed 's/:/ /'
+      return 0
+    fi
+  done
+  return 1
+}
+
+if ! TARGET_PLATFORM_SETTINGS=$(target_platform $TARGET_ARCH); then
+  echo "error: $TARGET_ARCH is not a valid architecture."
+  echo
+  usage
+  exit 1
+fi
+PLATFORM=${TARGET_PLATFORM_SETTINGS%% *}
+if [ -z "$BASE_IMAGE" ]; then
+  BASE_IMAGE=${TARGET_PLATFORM_SETTINGS#* }
+fi
+BUILD_IMAGE=vocalfusion-avs-build:$TARGET_ARCH
+
+# Make a directory given on the command line and print its absolute path
+make_dir() {
+  mkdir -p "$1" && ( cd "$1" && pwd )
+}
+
+if ! OUTPUT_DIR=$(make_dir "$OUTPUT_DIR"); then
+  echo "error: cannot create output directory $OUTPUT_DIR."
+  exit 1
+fi
+DOCKER_ARGS=(-v $OUTPUT_DIR:/artifact)
+AUTO_INSTALL_ARGS=(-S -o /artifact)
+# Directories of the host written by the container, handed back to the user
+# of this host at the end of the build
+HOST_DIRS=/artifact
+if [ -n "$CCACHE_DIR" ]; then
+  if ! CCACHE_DIR=$(make_dir "$CCACHE_DIR"); then
+    echo "error: cannot create ccache directory $CCACHE_DIR."
+    exit 1
+  fi
+  DOCKER_ARGS+=(-v $CCACHE_DIR:/ccache)
+  AUTO_INSTALL_ARGS+=(-c /ccache)
+  HOST_DIRS="$HOST_DIRS /ccache"
+fi
+if [ -n "$DOWNLOAD_CACHE_DIR" ]; then
+  if ! DOWNLOAD_CACHE_DIR=$(make_dir "$DOWNLOAD_CACHE_DIR"); then
+    echo "error: cannot create download cache directory $DOWNLOAD_CACHE_DIR."
+    exit 1
+  fi
+  DOCKER_ARGS+=(-v $DOWNLOAD_CACHE_DIR:/downloads)
+  AUTO_INSTALL_ARGS+=(-d /downloads)
+  HOST_DIRS="$HOST_DIRS /downloads"
+fi
+
+# Register QEMU to run the ARM binaries of the container, unless the host
+# can already run them
+if [[ ! "$(uname -m)" =~ ^(armv7l|aarch64)$ ]] &&
+    [ ! -e /proc/sys/fs/binfmt_misc/qemu-arm ] && [ ! -e /proc/sys/fs/binfmt_misc/qemu-aarch64 ]; then
+  echo "Registering QEMU user emulation for ARM binaries"
+  if ! docker run --rm --privileged tonistiigi/binfmt --install arm,arm64; then
+    echo "error: cannot register QEMU user emulation."
+    exit 1
+  fi
+fi
+
+# The image adds the tools used by auto_install.sh, sudo being a no-op for
+# the root user of the container
+echo "Creating build image $BUILD_IMAGE from $BASE_IMAGE"
+if ! docker build --platform $PLATFORM -t $BUILD_IMAGE - << EOF
+FROM $BASE_IMAGE
+RUN apt-get update && \
+    apt-get install -y sudo git wget ca-certificates jq && \
+    rm -rf /var/lib/apt/lists/*
+EOF
+then
+  echo "error: cannot create build image $BUILD_IMAGE."
+  exit 1
+fi
+
+BUILD_CMD="mkdir -p $TARGET_HOME/vocalfusion-avs-setup &&"
+for f in $SETUP_FILES; do
+  BUILD_CMD="$BUILD_CMD cp -r /setup/$f $TARGET_HOME/vocalfusion-avs-setup &&"
+done
+BUILD_CMD="$BUILD_CMD $TARGET_HOME/vocalfusion-avs-setup/auto_install.sh $XMOS_DEVICE ${AUTO_INSTALL_ARGS[*]}"
+for ARG in "${INSTALL_ARGS[@]}"; do
+  BUILD_CMD="$BUILD_CMD $(printf "%q" "$ARG")"
+done
+BUILD_CMD="$BUILD_CMD; STATUS=\$?; chown -R $(id -u):$(id -g) $HOST_DIRS; exit \$STATUS"
+
+# Only use a terminal in the container when there is one, such as for the
+# license agreements, so that the build also runs from scripts and cron
+DOCKER_ARGS+=(-i)
+if [ -t 0 ]; then
+  DOCKER_ARGS+=(-t)
+fi
+
+echo "Building AVS SDK for $TARGET_ARCH with $(nproc) CPUs"
+echo "Running command $BUILD_CMD"
+if ! docker run --rm --platform $PLATFORM -e HOME=$TARGET_HOME \
+    -v $SETUP_DIR:/setup:ro "${DOCKER_ARGS[@]}" $BUILD_IMAGE bash -c "$BUILD_CMD" ||
+   ! ls $OUTPUT_DIR/*.tar.gz > /dev/null 2>&1; then
+  echo "error: cannot build AVS SDK for $TARGET_ARCH."
+  exit 1
+fi
+echo "Prebuilt AVS SDK saved in $OUTPUT_DIR"
+popd > /dev/null
@@ -0,0 +1,178 @@
+#!/usr/bin/env bash
+# Copyright 2021 XMOS LIMITED. This software is subject to the terms of the
+# XMOS Public Licence, Version 1
+pushd "$( dirname "${BASH_SOURCE[0]}" )" > /dev/null
+SETUP_DIR="$( pwd )"
+source $SETUP_DIR/tools/fleet_common.sh
+
+# Build the AVS SDK on this Raspberry Pi by default, rather than installing
+# a prebuilt artifact
+ARTIFACT_LOCATION=
+# Do not reboot the Raspberry Pis after the install by default
+REBOOT_TARGETS=
+OUTPUT_DIR=$SETUP_DIR/fleet
+
+usage() {
+  cat <<EOT
+usage: fleet_install.sh <DEVICE-TYPE> <FLEET-FILE> [OPTIONS] [-- INSTALL-OPTIONS]
+
+Install many Raspberry Pis with the same DEVICE-TYPE by building the AVS SDK
+once, on this Raspberry Pi, and pushing it as a prebuilt artifact to every
+Raspberry Pi of the FLEET-FILE over SSH. Each Raspberry Pi is then set up
+and configured for its own serial number by auto_install.sh, without
+building the AVS SDK. This Raspberry Pi only builds the AVS SDK and is not
+set up itself.
+
+The FLEET-FILE is a CSV file with a line for each Raspberry Pi:
+   <serial-number>,<[user@]host>
+
+The Raspberry Pis must accept SSH connections without a password, and their
+user must have the same home directory as the user of this Raspberry Pi.
+The INSTALL-OPTIONS are passed to auto_install.sh on this Raspberry Pi and
+on each Raspberry Pi of the fleet.
+
+The log of each Raspberry Pi and a CSV report of the fleet install are saved
+in the output directory.
+
+Optional parameters:
+  -b <location>       Push the prebuilt AVS SDK artifact from the given
+                      directory, or install it from the given http(s) URL,
+                      rather than building the AVS SDK on this Raspberry Pi
+  -o <output-dir>     Output directory, default is $OUTPUT_DIR
+  -P <installs>       Number of Raspberry Pis installed at the same time,
+                      default is $PARALLEL_INSTALLS
+  -r                  Flag to reboot each Raspberry Pi after its install
+  -h                  Display this help and exit
+EOT
+}
+
+if [ $# -lt 2 ] || [ $1 == '-h' ]; then
+    usage
+    exit 1
+fi
+
+XMOS_DEVICE=$1
+FLEET_FILE=$2
+shift 2
+
+OPTIONS=b:o:P:rh
+while getopts "$OPTIONS" opt ; do
+    case $opt in
+        b )
+            ARTIFACT_LOCATION="$OPTARG"
+            ;;
+        o )
+            OUTPUT_DIR="$OPTARG"
+            ;;
+        P )
+            PARALLEL_INSTALLS="$OPTARG"
+            ;;
+        r )
+            REBOOT_TARGETS=y
+            ;;
+        h )
+            usage
+            exit 1
+            ;;
+    esac
+done
+shift $(( OPTIND - 1 ))
+INSTALL_ARGS=("$@")
+
+if [ ! -f "$FLEET_FILE" ]; then
+  echo "error: fleet file $FLEET_FILE not found."
+  echo
+  usage
+  exit 1
+fi
+
+if [ ! -f config.json ]; then
+  echo "error: config JSON file not found."
+  echo
+  usage
+  exit 1
+fi
+
+if [[ ! "$PARALLEL_INSTALLS" =~ ^[1-9][0-9]*$ ]]; then
+  echo "error: $PARALLEL_INSTALLS is not a valid number of installs."
+  echo
+  usage
+  exit 1
+fi
+
+# Install a Raspberry Pi of the fleet with its serial number
+install_target() {
+  local SERIAL=$1
+  local HOST=$2
+  local REMOTE_ARTIFACT_LOCATION=$ARTIFACT_LOCATION
+  local REMOTE_CMD=
+  if [ -n "$ARTIFACT_DIR" ]; then
+    REMOTE_ARTIFACT_LOCATION="\$HOME/$REMOTE_SETUP_DIR/artifact"
+  fi
+  REMOTE_CMD="cd $REMOTE_SETUP_DIR && ./auto_install.sh $XMOS_DEVICE -b $REMOTE_ARTIFACT_LOCATION$(remote_args -s "$SERIAL" "${INSTALL_ARGS[@]}")"
+  echo "Pushing setup to $HOST"
+  push_setup $HOST || return 1
+  echo "Running command $REMOTE_CMD on $HOST"
+  ssh $SSH_OPTIONS $HOST "$REMOTE_CMD" < /dev/null || return 1
+  if [ -n "$REBOOT_TARGETS" ]; then
+    ssh $SSH_OPTIONS $HOST "sudo reboot" < /dev/null
+  fi
+  return 0
+}
+
+# Install a Raspberry Pi of the fleet, recording its log, status and wall
+# time in the output directory
+run_target() {
+  local SERIAL=$1
+  local HOST=$2
+  local START=$(date +%s)
+  local STATUS=ok
+  if ! install_target $SERIAL $HOST > $OUTPUT_DIR/$SERIAL.log 2>&1; then
+    STATUS=failed
+  fi
+  echo "$SERIAL,$HOST,$STATUS,$(( $(date +%s) - START ))" > $OUTPUT_DIR/$SERIAL.result
+  echo "$SERIAL on $HOST: $STATUS"
+}
+
+if ! mkdir -p "$OUTPUT_DIR"; then
+  echo "error: cannot create output directory $OUTPUT_DIR."
+  exit 1
+fi
+OUTPUT_DIR="$( cd "$OUTPUT_DIR" && pwd )"
+REPORT_FILE=$OUTPUT_DIR/fleet_report.csv
+
+TARGETS=$(fleet_targets $FLEET_FILE serial)
+if [ -z "$TARGETS" ]; then
+  echo "error: no Raspberry Pis found in $FLEET_FILE."
+  exit 1
+fi
+
+# Build the AVS SDK once, on this Raspberry Pi, for the whole fleet
+ARTIFACT_DIR=
+if [ -z "$ARTIFACT_LOCATION" ]; then
+  ARTIFACT_DIR=$OUTPUT_DIR/artifact
+  rm -rf $ARTIFACT_DIR
+  echo "Building AVS SDK for the fleet"
+  if ! ./auto_install.sh $XMOS_DEVICE -S -o $ARTIFACT_DIR "${INSTALL_ARGS[@]}" ||
+     ! ls $ARTIFACT_DIR/*.tar.gz > /dev/null 2>&1; then
+    echo "error: cannot build AVS SDK for the fleet."
+    exit 1
+  fi
+elif [[ ! "$ARTIFACT_LOCATION" =~ ^https?:// ]]; then
+  ARTIFACT_DIR="$( cd "$ARTIFACT_LOCATION" && pwd )"
+fi
+
+echo "Installing $(echo "$TARGETS" | wc -l) Raspberry Pis, $PARALLEL_INSTALLS at a time"
+rm -f $OUTPUT_DIR/*.result
+run_on_targets run_target "$TARGETS"
+
+echo "serial,host,status,wall_time_s" > $REPORT_FILE
+cat $OUTPUT_DIR/*.result >> $REPORT_FILE
+rm -f $OUTPUT_DIR/*.result
+echo "Fleet report saved in $REPORT_FILE"
+FAILED=$(grep -c ",failed," $REPORT_FILE)
+popd > /dev/null
+if [ $FAILED -gt 0 ]; then
+  echo "error: $FAILED Raspberry Pis failed to install."
+  exit 1
+fi
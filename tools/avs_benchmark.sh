@@ -0,0 +1,160 @@
+#!/usr/bin/env bash
+# Copyright 2021 XMOS LIMITED. This software is subject to the terms of the
+# XMOS Public Licence, Version 1
+source "$( dirname "${BASH_SOURCE[0]}" )/avs_common.sh"
+
+# Default number of times the corpus is played
+REPEATS=1
+# Default number of seconds to wait for the response to an utterance
+RESPONSE_TIMEOUT=20
+# Play the utterances on the default ALSA device by default
+APLAY_DEVICE_ARGS=
+OUTPUT_DIR=$SETUP_DIR/benchmark
+
+usage() {
+  cat <<EOT
+usage: avs_benchmark.sh <CORPUS-DIR> [OPTIONS]
+
+Measure the latency of the Sample App installed by auto_install.sh by
+playing each WAV file of the CORPUS-DIR, such as "Alexa, what time is it?",
+through the speakers and timestamping the Sample App output.
+
+For each utterance, the latencies measured are:
+   detection        from the start of the utterance to the keyword detection
+   upload           from the keyword detection to the start of the recognize
+                    upload
+   first_response   from the end of the utterance to the first response
+   first_audio_out  from the end of the utterance to the first audio out
+
+The upload and first response points are found in the SDK debug logs and
+are only measured when the Sample App logs at debug level.
+
+The results of each utterance and a JSON report with the 50th, 95th and
+99th percentiles of each latency are saved in the output directory, named
+after the device type and keyword detector installed.
+
+Optional parameters:
+  -D <alsa-device>    ALSA device to play the utterances on
+  -n <repeats>        Number of times the corpus is played, default is 1
+  -o <output-dir>     Output directory, default is $OUTPUT_DIR
+  -t <timeout>        Number of seconds to wait for the response to an
+                      utterance, default is $RESPONSE_TIMEOUT
+  -h                  Display this help and exit
+EOT
+}
+
+if [ $# -lt 1 ] || [ $1 == '-h' ]; then
+  usage
+  exit 1
+fi
+
+CORPUS_DIR=$1
+shift 1
+
+OPTIONS=D:n:o:t:h
+while getopts "$OPTIONS" opt ; do
+    case $opt in
+        D )
+            APLAY_DEVICE_ARGS="-D $OPTARG"
+            ;;
+        n )
+            REPEATS="$OPTARG"
+            ;;
+        o )
+            OUTPUT_DIR="$OPTARG"
+            ;;
+        t )
+            RESPONSE_TIMEOUT="$OPTARG"
+            ;;
+        h )
+            usage
+            exit 1
+            ;;
+    esac
+done
+
+if ! ls "$CORPUS_DIR"/*.wav > /dev/null 2>&1; then
+  echo "error: no WAV files found in $CORPUS_DIR."
+  exit 1
+fi
+
+DEVICE=$(installed_device)
+DETECTOR=$(installed_detector)
+if [ -z "$DEVICE" ]; then
+  echo "error: the AVS SDK has not been installed by auto_install.sh."
+  exit 1
+fi
+
+mkdir -p "$OUTPUT_DIR"
+RUN_NAME=benchmark_${DEVICE}_${DETECTOR}
+RESULTS_FILE=$OUTPUT_DIR/$RUN_NAME.csv
+REPORT_FILE=$OUTPUT_DIR/$RUN_NAME.json
+
+# Print the time of a marker, or nothing if there is no marker
+marker_time() {
+  echo $2
+}
+
+# Play an utterance and wait for the Sample App to respond to it and return
+# to idle, then save the timestamps of the interaction
+benchmark_utterance() {
+  local UTTERANCE=$1
+  local SINCE=$(sample_app_log_offset)
+  local PLAY_START=$EPOCHREALTIME
+  aplay -q $APLAY_DEVICE_ARGS "$UTTERANCE"
+  local PLAY_END=$EPOCHREALTIME
+  local AUDIO_OUT=$(wait_for_marker "$SAMPLE_APP_AUDIO_OUT_PATTERN" $SINCE $RESPONSE_TIMEOUT)
+  if [ -n "$AUDIO_OUT" ]; then
+    wait_for_marker "$SAMPLE_APP_IDLE_PATTERN" ${AUDIO_OUT% *} $RESPONSE_TIMEOUT > /dev/null
+  else
+    wait_for_marker "$SAMPLE_APP_IDLE_PATTERN" $SINCE $RESPONSE_TIMEOUT > /dev/null
+  fi
+  echo "$(basename "$UTTERANCE"),$PLAY_START,$PLAY_END,$(marker_time $(find_marker "$SAMPLE_APP_DETECTION_PATTERN" $SINCE)),$(marker_time $(find_marker "$SAMPLE_APP_UPLOAD_PATTERN" $SINCE)),$(marker_time $(find_marker "$SAMPLE_APP_RESPONSE_PATTERN" $SINCE)),$(marker_time $AUDIO_OUT)" >> $RESULTS_FILE
+}
+
+# Print the given latency of each utterance of the results, one per line
+latencies() {
+  awk -F, -v latency=$1 'NR > 1 {
+    if (latency == "detection" && $4 != "") print $4 - $2
+    if (latency == "upload" && $4 != "" && $5 != "") print $5 - $4
+    if (latency == "first_response" && $6 != "") print $6 - $3
+    if (latency == "first_audio_out" && $7 != "") print $7 - $3
+  }' $RESULTS_FILE
+}
+
+write_report() {
+  local UTTERANCES=$(( $(wc -l < $RESULTS_FILE) - 1 ))
+  local DETECTED=$(awk -F, 'NR > 1 && $4 != ""' $RESULTS_FILE | wc -l)
+  cat << EOT > $REPORT_FILE
+{
+  "device": "$DEVICE",
+  "detector": "$DETECTOR",
+  "avs_device_sdk_tag": "$(installed_avs_device_sdk_tag)",
+  "utterances": $UTTERANCES,
+  "detected": $DETECTED,
+  "latencies_s": {
+    "detection": $(latencies detection | latency_summary),
+    "upload": $(latencies upload | latency_summary),
+    "first_response": $(latencies first_response | latency_summary),
+    "first_audio_out": $(latencies first_audio_out | latency_summary)
+  }
+}
+EOT
+}
+
+echo "utterance,play_start,play_end,detection,upload,response,audio_out" > $RESULTS_FILE
+echo "Starting the Sample App..."
+if ! start_sample_app $OUTPUT_DIR/$RUN_NAME.log; then
+  exit 1
+fi
+for (( i = 1; i <= REPEATS; ++i )); do
+  for UTTERANCE in "$CORPUS_DIR"/*.wav; do
+    echo "Playing $(basename "$UTTERANCE") ($i/$REPEATS)"
+    benchmark_utterance "$UTTERANCE"
+  done
+done
+stop_sample_app
+
+write_report
+echo "Benchmark report saved in $REPORT_FILE"
+cat $REPORT_FILE
@@ -0,0 +1,71 @@
+#!/usr/bin/env bash
+# Copyright 2021 XMOS LIMITED. This software is subject to the terms of the
+# XMOS Public Licence, Version 1
+source "$( dirname "${BASH_SOURCE[0]}" )/avs_common.sh"
+
+BOOT_REPORT_FILE=$SETUP_DIR/boot_report.json
+
+usage() {
+  cat <<EOT
+usage: avs_boot_report.sh [OPTIONS]
+
+Report the startup time of the Sample App run by the avsrun service
+installed by auto_install.sh -f, for the current boot. The time from the
+start of the kernel to the sound card, to the start of the service and
+to the Sample App being ready is saved in $BOOT_REPORT_FILE.
+
+Optional parameters:
+  -h                  Display this help and exit
+EOT
+}
+
+if [ $# -gt 0 ]; then
+  usage
+  exit 1
+fi
+
+# Print the time a systemd unit became active in this boot, in seconds
+# since the start of the kernel
+unit_active_time() {
+  systemctl show $1 -p ActiveEnterTimestampMonotonic --value | awk '$1 > 0 { printf "%.3f", $1 / 1000000 }'
+}
+
+# Print the time the Sample App of the avsrun service was first idle in
+# this boot, in seconds since the start of the kernel
+sample_app_ready_time() {
+  journalctl -b -u avsrun.service -o short-monotonic --no-pager |
+    awk -v pattern="$SAMPLE_APP_IDLE_PATTERN" '$0 ~ pattern && match($0, /^\[ *[0-9.]+\]/) {
+      printf "%.3f", substr($0, RSTART + 1, RLENGTH - 2)
+      exit
+    }'
+}
+
+# Print a stage of the report, with the time it was reached in seconds
+# since the start of the kernel
+report_stage() {
+  echo "    { \"name\": \"$1\", \"time_since_boot_s\": ${2:-null} }"
+}
+
+SOUND_TIME=$(unit_active_time sound.target)
+SERVICE_TIME=$(unit_active_time avsrun.service)
+READY_TIME=$(sample_app_ready_time)
+if [ -z "$SERVICE_TIME" ]; then
+  echo "error: the avsrun service has not been started in this boot."
+  exit 1
+fi
+
+cat << EOT > $BOOT_REPORT_FILE
+{
+  "device": "$(installed_device)",
+  "detector": "$(installed_detector)",
+  "avs_device_sdk_tag": "$(installed_avs_device_sdk_tag)",
+  "boot_id": "$(cat /proc/sys/kernel/random/boot_id)",
+  "stages": [
+$(report_stage sound_card $SOUND_TIME),
+$(report_stage avsrun_service $SERVICE_TIME),
+$(report_stage sample_app_ready $READY_TIME)
+  ]
+}
+EOT
+echo "Boot report saved in $BOOT_REPORT_FILE"
+cat $BOOT_REPORT_FILE
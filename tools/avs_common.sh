@@ -0,0 +1,179 @@
+# Copyright 2021 XMOS LIMITED. This software is subject to the terms of the
+# XMOS Public Licence, Version 1
+#
+# Common definitions for auto_install.sh and the tools run against the AVS
+# SDK Sample App it installs. This file is sourced by auto_install.sh and by
+# the tools.
+
+TOOLS_DIR="$( cd "$( dirname "${BASH_SOURCE[0]}" )" && pwd )"
+SETUP_DIR="$( dirname "$TOOLS_DIR" )"
+# Record of the inputs each install stage was last completed with, used by
+# the incremental re-install to decide which stages can be skipped
+STATE_FILE=$SETUP_DIR/.install_state
+
+# Directory of the AVS SDK installed by the AVS setup.sh, with the SDK
+# sources and the script starting the Sample App
+SDK_DIR=$HOME/sdk-folder
+SDK_SOURCE_DIR=$SDK_DIR/avs-device-sdk
+AVSRUN_SCRIPT=$SDK_SOURCE_DIR/tools/Install/.avsrun-startup.sh
+
+# Patterns of the Sample App output marking the points of an interaction.
+# The idle, detection and audio out points are the dialog states printed
+# by the Sample App. The upload and response points are found in the SDK
+# logs, so they are only seen when the Sample App logs at debug level.
+SAMPLE_APP_IDLE_PATTERN=${SAMPLE_APP_IDLE_PATTERN:-"Alexa is currently idle"}
+SAMPLE_APP_DETECTION_PATTERN=${SAMPLE_APP_DETECTION_PATTERN:-"Listening[.][.][.]"}
+SAMPLE_APP_UPLOAD_PATTERN=${SAMPLE_APP_UPLOAD_PATTERN:-"SpeechRecognizer.*Recognize"}
+SAMPLE_APP_RESPONSE_PATTERN=${SAMPLE_APP_RESPONSE_PATTERN:-"SpeechSynthesizer.*Speak"}
+SAMPLE_APP_AUDIO_OUT_PATTERN=${SAMPLE_APP_AUDIO_OUT_PATTERN:-"Speaking[.][.][.]"}
+# Pattern of the audio overruns and underruns reported in the Sample App output
+SAMPLE_APP_XRUN_PATTERN=${SAMPLE_APP_XRUN_PATTERN:-"[Oo]verflow|[Oo]verrun|[Uu]nderrun|[Xx]run"}
+
+# Number of glibc malloc arenas of the Sample App, run by the tools and by
+# the avsrun service of auto_install.sh. The glibc default of 2 arenas per
+# CPU on the 32-bit Raspberry Pi OS, and 8 per CPU on the 64-bit one, lets
+# the heap of the SDK threads spread over many arenas, whose free memory
+# grows the resident memory over days.
+SAMPLE_APP_MALLOC_ARENA_MAX=2
+
+# Number of seconds to wait for the Sample App to be ready
+SAMPLE_APP_STARTUP_TIMEOUT=120
+
+# Print the inputs the AVS SDK was last installed with
+installed_avs_sdk() {
+  if [ -f $STATE_FILE ]; then
+    grep "^avs_sdk=" $STATE_FILE | cut -d= -f2-
+  fi
+}
+
+# Print the XMOS device the AVS SDK was installed for
+installed_device() {
+  installed_avs_sdk | awk '{ print $2 }'
+}
+
+# Print the AVS SDK version which was installed
+installed_avs_device_sdk_tag() {
+  installed_avs_sdk | awk '{ print $1 }'
+}
+
+# Print the keyword detector the AVS SDK was installed with
+installed_detector() {
+  local INPUTS=" $(installed_avs_sdk) "
+  if [[ "$INPUTS" == *" -G "* ]]; then
+    echo gpio
+  elif [[ "$INPUTS" == *" -H "* ]]; then
+    echo hid
+  else
+    echo sensory
+  fi
+}
+
+# Prefix each line with the time it was read at, in seconds since the epoch
+timestamp_lines() {
+  local LINE
+  while IFS= read -r LINE; do
+    echo "$EPOCHREALTIME $LINE"
+  done
+}
+
+# Start the Sample App in the background, saving its timestamped output in
+# the given log file. Its input is kept open so that it keeps running.
+start_sample_app() {
+  SAMPLE_APP_LOG=$1
+  if pgrep -x SampleApp > /dev/null; then
+    echo "error: the Sample App is already running."
+    return 1
+  fi
+  SAMPLE_APP_INPUT=$(mktemp -u)
+  mkfifo $SAMPLE_APP_INPUT
+  exec {SAMPLE_APP_INPUT_FD}<> $SAMPLE_APP_INPUT
+  MALLOC_ARENA_MAX=$SAMPLE_APP_MALLOC_ARENA_MAX stdbuf -oL -eL $AVSRUN_SCRIPT < $SAMPLE_APP_INPUT 2>&1 | timestamp_lines > $SAMPLE_APP_LOG &
+  SAMPLE_APP_PID=$!
+  if ! wait_for_marker "$SAMPLE_APP_IDLE_PATTERN" 0 $SAMPLE_APP_STARTUP_TIMEOUT > /dev/null; then
+    echo "error: the Sample App is not ready, check that the device is registered."
+    stop_sample_app
+    return 1
+  fi
+}
+
+# Quit the Sample App
+stop_sample_app() {
+  local i
+  echo q >&$SAMPLE_APP_INPUT_FD
+  for (( i = 0; i < 10; ++i )); do
+    if ! pgrep -x SampleApp > /dev/null; then
+      break
+    fi
+    sleep 1
+  done
+  pkill -x SampleApp
+  wait $SAMPLE_APP_PID 2> /dev/null
+  exec {SAMPLE_APP_INPUT_FD}>&-
+  rm -f $SAMPLE_APP_INPUT
+}
+
+# Print the CPU time taken by the Sample App with the given process ID, in
+# clock ticks
+sample_app_cpu_ticks() {
+  awk '{ print $14 + $15 }' /proc/$1/stat 2> /dev/null
+}
+
+# Print the size of the Sample App log, the offset of its next line. The
+# log is only read from such offsets, so that the tools do not read the
+# whole log again as it grows over a long run.
+sample_app_log_offset() {
+  stat -c %s $SAMPLE_APP_LOG
+}
+
+# Print the Sample App log from the given offset
+sample_app_log_after() {
+  tail -c +$(( $1 + 1 )) $SAMPLE_APP_LOG
+}
+
+# Print the offset after and the time of the first line of the Sample App
+# log from the given offset which matches the given pattern
+find_marker() {
+  sample_app_log_after $2 | LC_ALL=C awk -v pattern="$1" -v offset=$2 '
+    { offset += length($0) + 1 }
+    $0 ~ pattern { print offset, $1; exit }'
+}
+
+# Count the lines of the Sample App log between the given offsets which
+# match the given pattern
+count_markers() {
+  sample_app_log_after $2 | head -c $(( $3 - $2 )) | grep -Ec "$1"
+}
+
+# Wait for a line of the Sample App log from the given offset to match the
+# given pattern, for up to the given number of seconds, and print the offset
+# after it and its time
+wait_for_marker() {
+  local PATTERN=$1
+  local SINCE=$2
+  local TIMEOUT=$3
+  local END=$(( SECONDS + TIMEOUT ))
+  local MARKER=
+  while [ $SECONDS -le $END ]; do
+    MARKER=$(find_marker "$PATTERN" $SINCE)
+    if [ -n "$MARKER" ]; then
+      echo $MARKER
+      return 0
+    fi
+    sleep 0.1
+  done
+  return 1
+}
+
+# Print the count and the 50th, 95th and 99th percentiles of the numbers
+# read, one per line, as a JSON object
+latency_summary() {
+  sort -n | awk '
+    function percentile(p,    i) {
+      i = int((p * count + 99) / 100)
+      return i < 1 ? "null" : sprintf("%.3f", value[i])
+    }
+    { value[++count] = $1 }
+    END {
+      printf "{ \"count\": %d, \"p50\": %s, \"p95\": %s, \"p99\": %s }", count, percentile(50), percentile(95), percentile(99)
+    }'
+}
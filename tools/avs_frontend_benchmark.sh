@@ -0,0 +1,122 @@
+#!/usr/bin/env bash
+# Copyright 2021 XMOS LIMITED. This software is subject to the terms of the
+# XMOS Public Licence, Version 1
+source "$( dirname "${BASH_SOURCE[0]}" )/avs_common.sh"
+
+# Default number of seconds of audio captured and played for each path
+DURATION=20
+# ALSA PCMs of the audio paths, the default PCM being the one used by the
+# Sample App
+CAPTURE_PCM=default
+PLAYBACK_PCM=default
+# Formats of the audio paths: the stream captured by the AVS SDK and Sensory,
+# and the stream played by the GStreamer media player
+CAPTURE_FORMAT="-f S16_LE -r 16000 -c 1"
+CAPTURE_RATE=16000
+PLAYBACK_FORMAT="-f S16_LE -r 48000 -c 2"
+PLAYBACK_RATE=48000
+OUTPUT_DIR=$SETUP_DIR/benchmark
+
+usage() {
+  cat <<EOT
+usage: avs_frontend_benchmark.sh [OPTIONS]
+
+Measure the CPU cost of the ALSA audio paths set up by auto_install.sh for
+the installed device, which convert the samples of the device to and from
+the formats of the Sample App. The captured stream is the 16kHz 16-bit mono
+stream of the AVS SDK and Sensory, and the played stream is 48kHz 16-bit
+stereo silence.
+
+For each path, the CPU time taken by the conversion is reported as a
+percentage of one CPU, in microseconds per frame and in CPU cycles per
+frame at the maximum CPU frequency. The JSON report is saved in the output
+directory, named after the device type installed.
+
+Optional parameters:
+  -C <alsa-device>    ALSA capture device, default is $CAPTURE_PCM
+  -d <seconds>        Number of seconds of audio for each path, default is
+                      $DURATION
+  -o <output-dir>     Output directory, default is $OUTPUT_DIR
+  -P <alsa-device>    ALSA playback device, default is $PLAYBACK_PCM
+  -h                  Display this help and exit
+EOT
+}
+
+OPTIONS=C:d:o:P:h
+while getopts "$OPTIONS" opt ; do
+    case $opt in
+        C )
+            CAPTURE_PCM="$OPTARG"
+            ;;
+        d )
+            DURATION="$OPTARG"
+            ;;
+        o )
+            OUTPUT_DIR="$OPTARG"
+            ;;
+        P )
+            PLAYBACK_PCM="$OPTARG"
+            ;;
+        h )
+            usage
+            exit 1
+            ;;
+    esac
+done
+shift $(( OPTIND - 1 ))
+
+if [ $# -gt 0 ]; then
+  usage
+  exit 1
+fi
+
+if [[ ! "$DURATION" =~ ^[1-9][0-9]*$ ]]; then
+  echo "error: $DURATION is not a valid number of seconds."
+  echo
+  usage
+  exit 1
+fi
+
+DEVICE=$(installed_device)
+if [ -z "$DEVICE" ]; then
+  echo "error: the AVS SDK has not been installed by auto_install.sh."
+  exit 1
+fi
+
+mkdir -p "$OUTPUT_DIR"
+REPORT_FILE=$OUTPUT_DIR/frontend_$DEVICE.json
+CPU_MAX_FREQ_KHZ=$(cat /sys/devices/system/cpu/cpu0/cpufreq/cpuinfo_max_freq 2> /dev/null)
+
+# Run an audio command and print the user and system CPU seconds it took
+cpu_time() {
+  local TIMEFORMAT="%U %S"
+  { time "$@" > /dev/null 2>&1 ; } 2>&1
+}
+
+# Print the JSON object of an audio path from its CPU seconds and rate
+path_report() {
+  awk -v user=$1 -v sys=$2 -v rate=$3 -v duration=$DURATION -v freq_khz="$CPU_MAX_FREQ_KHZ" 'BEGIN {
+    cpu = user + sys
+    frames = rate * duration
+    printf "{ \"cpu_percent\": %.2f, \"cpu_us_per_frame\": %.3f, \"cycles_per_frame\": %s }",
+      100 * cpu / duration, 1000000 * cpu / frames, (freq_khz == "" ? "null" : sprintf("%.0f", cpu * freq_khz * 1000 / frames))
+  }'
+}
+
+echo "Measuring the capture path from $CAPTURE_PCM for $DURATION seconds"
+CAPTURE_CPU=$(cpu_time arecord -q -D $CAPTURE_PCM -t raw $CAPTURE_FORMAT -d $DURATION /dev/null)
+echo "Measuring the playback path to $PLAYBACK_PCM for $DURATION seconds"
+PLAYBACK_CPU=$(cpu_time aplay -q -D $PLAYBACK_PCM -t raw $PLAYBACK_FORMAT -d $DURATION /dev/zero)
+
+cat << EOT > $REPORT_FILE
+{
+  "device": "$DEVICE",
+  "model": "$(tr -d '\0' 2> /dev/null < /proc/device-tree/model)",
+  "cpu_max_freq_khz": ${CPU_MAX_FREQ_KHZ:-null},
+  "duration_s": $DURATION,
+  "capture": $(path_report $CAPTURE_CPU $CAPTURE_RATE),
+  "playback": $(path_report $PLAYBACK_CPU $PLAYBACK_RATE)
+}
+EOT
+echo "Frontend benchmark report saved in $REPORT_FILE"
+cat $REPORT_FILE
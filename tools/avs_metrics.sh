@@ -0,0 +1,192 @@
+#!/usr/bin/env bash
+# Copyright 2021 XMOS LIMITED. This software is subject to the terms of the
+# XMOS Public Licence, Version 1
+source "$( dirname "${BASH_SOURCE[0]}" )/avs_common.sh"
+
+# Default number of seconds between the updates of the metrics file
+METRICS_INTERVAL=15
+# Upper bounds in seconds of the latency histogram buckets
+METRICS_BUCKETS="0.05 0.1 0.25 0.5 1 2.5 5 10"
+METRICS_FILE=$SETUP_DIR/metrics/avs_sample_app.prom
+
+usage() {
+  cat <<EOT
+usage: avs_metrics.sh [OPTIONS]
+
+Export the metrics of the Sample App run by the avsrun service installed
+by auto_install.sh -f, in the Prometheus text format, for the textfile
+collector of the Prometheus node exporter. The metrics are read from the
+output of the Sample App in the journal, outside of the Sample App, and
+the metrics file is updated every interval.
+
+The metrics exported are:
+   avs_keyword_detections_total         keyword detections, by detector
+   avs_detection_to_upload_seconds      histogram of the time from the
+                                        keyword detection to the start of
+                                        the recognize upload
+   avs_upload_to_response_seconds       histogram of the time from the
+                                        start of the recognize upload to
+                                        the response of the AVS server
+   avs_response_to_audio_out_seconds    histogram of the time from the
+                                        response to the start of playback
+   avs_audio_xruns_total                audio overruns and underruns
+   avs_sample_app_resident_memory_bytes resident memory of the Sample App
+   avs_sample_app_up                    1 if the Sample App is running
+
+The upload and response points are found in the SDK debug logs, so their
+histograms are only updated when the Sample App logs at debug level.
+
+Optional parameters:
+  -i <interval>       Number of seconds between the updates of the metrics
+                      file, default is $METRICS_INTERVAL
+  -o <metrics-file>   Metrics file, default is $METRICS_FILE
+  -h                  Display this help and exit
+EOT
+}
+
+OPTIONS=i:o:h
+while getopts "$OPTIONS" opt ; do
+    case $opt in
+        i )
+            METRICS_INTERVAL="$OPTARG"
+            ;;
+        o )
+            METRICS_FILE="$OPTARG"
+            ;;
+        h )
+            usage
+            exit 1
+            ;;
+    esac
+done
+shift $(( OPTIND - 1 ))
+
+if [ $# -gt 0 ]; then
+  usage
+  exit 1
+fi
+
+if [[ ! "$METRICS_INTERVAL" =~ ^[1-9][0-9]*$ ]]; then
+  echo "error: $METRICS_INTERVAL is not a valid interval."
+  echo
+  usage
+  exit 1
+fi
+
+if ! mkdir -p "$(dirname "$METRICS_FILE")"; then
+  echo "error: cannot create metrics directory $(dirname "$METRICS_FILE")."
+  exit 1
+fi
+
+# Print the output of the avsrun service as it is written, with a tick line
+# every interval to update the metrics file
+sample_app_events() {
+  journalctl -u avsrun.service -f -n 0 -o short-unix --no-pager &
+  while sleep $METRICS_INTERVAL; do
+    echo "#tick"
+  done
+}
+
+# mawk reads its input from a pipe in blocks unless it is interactive
+AWK_ARGS=
+if awk -W version 2>&1 | grep -q mawk; then
+  AWK_ARGS="-W interactive"
+fi
+
+echo "Exporting Sample App metrics to $METRICS_FILE every $METRICS_INTERVAL seconds"
+sample_app_events | awk $AWK_ARGS -v metrics_file="$METRICS_FILE" -v buckets="$METRICS_BUCKETS" -v detector=$(installed_detector) \
+    -v detection_pattern="$SAMPLE_APP_DETECTION_PATTERN" -v upload_pattern="$SAMPLE_APP_UPLOAD_PATTERN" \
+    -v response_pattern="$SAMPLE_APP_RESPONSE_PATTERN" -v audio_out_pattern="$SAMPLE_APP_AUDIO_OUT_PATTERN" \
+    -v xrun_pattern="$SAMPLE_APP_XRUN_PATTERN" '
+  function observe(name, value,    i) {
+    for (i = 1; i <= bucket_count; ++i) {
+      if (value <= bound[i]) {
+        histogram[name, i]++
+      }
+    }
+    histogram_sum[name] += value
+    histogram_count[name]++
+  }
+  function write_histogram(file, name, help,    i) {
+    printf "# HELP %s %s\n# TYPE %s histogram\n", name, help, name > file
+    for (i = 1; i <= bucket_count; ++i) {
+      printf "%s_bucket{le=\"%s\"} %d\n", name, bound[i], histogram[name, i] > file
+    }
+    printf "%s_bucket{le=\"+Inf\"} %d\n", name, histogram_count[name] > file
+    printf "%s_sum %.6f\n%s_count %d\n", name, histogram_sum[name], name, histogram_count[name] > file
+  }
+  # Read the resident memory of the Sample App, zero when it is not running
+  function read_resident_memory(    cmd, pid, file, line, field) {
+    cmd = "pgrep -xo SampleApp"
+    pid = ""
+    cmd | getline pid
+    close(cmd)
+    resident_memory = 0
+    up = 0
+    if (pid == "") {
+      return
+    }
+    file = "/proc/" pid "/status"
+    while ((getline line < file) > 0) {
+      if (line ~ /^VmRSS:/) {
+        split(line, field)
+        resident_memory = field[2] * 1024
+        up = 1
+      }
+    }
+    close(file)
+  }
+  # Write the metrics to a temporary file and move it into place, so that
+  # the node exporter never reads a partial file
+  function write_metrics(    file) {
+    read_resident_memory()
+    file = metrics_file ".tmp"
+    printf "# HELP avs_keyword_detections_total Keyword detections of the Sample App.\n" > file
+    printf "# TYPE avs_keyword_detections_total counter\n" > file
+    printf "avs_keyword_detections_total{detector=\"%s\"} %d\n", detector, detections > file
+    write_histogram(file, "avs_detection_to_upload_seconds", "Time from the keyword detection to the start of the recognize upload.")
+    write_histogram(file, "avs_upload_to_response_seconds", "Time from the start of the recognize upload to the response of the AVS server.")
+    write_histogram(file, "avs_response_to_audio_out_seconds", "Time from the response of the AVS server to the start of playback.")
+    printf "# HELP avs_audio_xruns_total Audio overruns and underruns reported by the Sample App.\n" > file
+    printf "# TYPE avs_audio_xruns_total counter\n" > file
+    printf "avs_audio_xruns_total %d\n", xruns > file
+    printf "# HELP avs_sample_app_resident_memory_bytes Resident memory of the Sample App.\n" > file
+    printf "# TYPE avs_sample_app_resident_memory_bytes gauge\n" > file
+    printf "avs_sample_app_resident_memory_bytes %d\n", resident_memory > file
+    printf "# HELP avs_sample_app_up Whether the Sample App is running.\n" > file
+    printf "# TYPE avs_sample_app_up gauge\n" > file
+    printf "avs_sample_app_up %d\n", up > file
+    close(file)
+    system("mv \"" file "\" \"" metrics_file "\"")
+  }
+  BEGIN {
+    bucket_count = split(buckets, bound, " ")
+    write_metrics()
+  }
+  /^#tick$/ {
+    write_metrics()
+    next
+  }
+  $0 ~ detection_pattern {
+    detections++
+    detection_time = $1
+    upload_time = ""
+    response_time = ""
+  }
+  $0 ~ upload_pattern && detection_time != "" {
+    observe("avs_detection_to_upload_seconds", $1 - detection_time)
+    detection_time = ""
+    upload_time = $1
+  }
+  $0 ~ response_pattern && upload_time != "" {
+    observe("avs_upload_to_response_seconds", $1 - upload_time)
+    upload_time = ""
+    response_time = $1
+  }
+  $0 ~ audio_out_pattern && response_time != "" {
+    observe("avs_response_to_audio_out_seconds", $1 - response_time)
+    response_time = ""
+  }
+  $0 ~ xrun_pattern {
+    xruns++
+  }'
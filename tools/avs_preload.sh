@@ -0,0 +1,11 @@
+#!/usr/bin/env bash
+# Copyright 2021 XMOS LIMITED. This software is subject to the terms of the
+# XMOS Public Licence, Version 1
+#
+# Read the Sample App, its libraries, the Sensory models and the AVS SDK
+# databases into the page cache. This is run early in the boot by the
+# avsrun-preload service installed by auto_install.sh -f, while the rest
+# of the system starts and the sound card is probed.
+source "$( dirname "${BASH_SOURCE[0]}" )/avs_common.sh"
+
+find $SDK_DIR -type f \( -name SampleApp -o -name "*.so*" -o -name "*.snsr" -o -name "*.db" \) -exec cat {} + > /dev/null
@@ -0,0 +1,231 @@
+#!/usr/bin/env bash
+# Copyright 2021 XMOS LIMITED. This software is subject to the terms of the
+# XMOS Public Licence, Version 1
+source "$( dirname "${BASH_SOURCE[0]}" )/avs_common.sh"
+
+# Default channel of the recordings holding the ASR output of the device
+ASR_CHANNEL=0
+# Default number of seconds to wait for a keyword detection after the end of
+# a recording
+DETECTION_TIMEOUT=3
+# ALSA loopback devices the recordings are played to and the Sample App
+# captures from
+LOOPBACK_PLAYBACK=hw:Loopback,0,0
+LOOPBACK_CAPTURE=hw:Loopback,1,0
+ASOUNDRC=$HOME/.asoundrc
+OUTPUT_DIR=$SETUP_DIR/replay
+
+usage() {
+  cat <<EOT
+usage: avs_replay.sh <RECORDINGS-DIR> [OPTIONS]
+
+Replay the WAV files of the RECORDINGS-DIR, recorded from the device with
+arecord, into the capture path of the Sample App installed by
+auto_install.sh, without the device, speakers or a quiet room. The
+recordings are played in real time to the ALSA loopback device, which the
+Sample App captures from instead of the device while the replay runs, and
+the responses of the Sample App are discarded.
+
+A recording can have a label file with the same name and a .txt extension,
+with the time in seconds of the end of each keyword in the recording, one
+per line. The keyword detection latency is then measured from these times.
+
+For each recording, the number of keyword detections, their time from the
+start of the recording, the detection latencies and the CPU load of the
+Sample App are saved in the CSV results, and a JSON report with the 50th,
+95th and 99th percentiles of the detection latency is saved in the output
+directory, named after the device type and keyword detector installed.
+
+Optional parameters:
+  -c <channel>        Channel of the recordings holding the ASR output,
+                      default is $ASR_CHANNEL
+  -o <output-dir>     Output directory, default is $OUTPUT_DIR
+  -t <timeout>        Number of seconds to wait for a keyword detection after
+                      the end of a recording, default is $DETECTION_TIMEOUT
+  -h                  Display this help and exit
+EOT
+}
+
+if [ $# -lt 1 ] || [ $1 == '-h' ]; then
+  usage
+  exit 1
+fi
+
+RECORDINGS_DIR=$1
+shift 1
+
+OPTIONS=c:o:t:h
+while getopts "$OPTIONS" opt ; do
+    case $opt in
+        c )
+            ASR_CHANNEL="$OPTARG"
+            ;;
+        o )
+            OUTPUT_DIR="$OPTARG"
+            ;;
+        t )
+            DETECTION_TIMEOUT="$OPTARG"
+            ;;
+        h )
+            usage
+            exit 1
+            ;;
+    esac
+done
+
+if ! ls "$RECORDINGS_DIR"/*.wav > /dev/null 2>&1; then
+  echo "error: no WAV files found in $RECORDINGS_DIR."
+  exit 1
+fi
+
+if [[ ! "$ASR_CHANNEL" =~ ^[0-9]+$ ]]; then
+  echo "error: $ASR_CHANNEL is not a valid channel."
+  echo
+  usage
+  exit 1
+fi
+
+if [[ ! "$DETECTION_TIMEOUT" =~ ^[1-9][0-9]*$ ]]; then
+  echo "error: $DETECTION_TIMEOUT is not a valid number of seconds."
+  echo
+  usage
+  exit 1
+fi
+
+DEVICE=$(installed_device)
+DETECTOR=$(installed_detector)
+if [ -z "$DEVICE" ]; then
+  echo "error: the AVS SDK has not been installed by auto_install.sh."
+  exit 1
+fi
+
+mkdir -p "$OUTPUT_DIR"
+RUN_NAME=replay_${DEVICE}_${DETECTOR}
+RESULTS_FILE=$OUTPUT_DIR/$RUN_NAME.csv
+LATENCIES_FILE=$OUTPUT_DIR/$RUN_NAME.latencies
+REPORT_FILE=$OUTPUT_DIR/$RUN_NAME.json
+CLOCK_TICKS=$(getconf CLK_TCK)
+
+# Make the loopback device the default capture PCM, with the ASR channel of
+# the recordings, and discard the playback of the Sample App, until the
+# ALSA configuration is restored
+use_loopback() {
+  sudo modprobe snd-aloop || return 1
+  ASOUNDRC_BACKUP=$(mktemp)
+  if [ -f $ASOUNDRC ]; then
+    cp $ASOUNDRC $ASOUNDRC_BACKUP
+  fi
+  cat << EOF >> $ASOUNDRC
+# Replay PCMs added by avs_replay.sh
+pcm.avs_replay_playback {
+    type plug
+    slave.pcm "$LOOPBACK_PLAYBACK"
+    slave.channels 1
+    ttable.$ASR_CHANNEL.0 1
+}
+pcm.avs_replay_capture {
+    type plug
+    slave.pcm "$LOOPBACK_CAPTURE"
+}
+pcm.!default {
+    type asym
+    playback.pcm "null"
+    capture.pcm "avs_replay_capture"
+}
+EOF
+  trap restore_alsa_config EXIT
+}
+
+restore_alsa_config() {
+  if [ -s $ASOUNDRC_BACKUP ]; then
+    cp $ASOUNDRC_BACKUP $ASOUNDRC
+  else
+    rm -f $ASOUNDRC
+  fi
+  rm -f $ASOUNDRC_BACKUP
+}
+
+# Play a recording into the Sample App capture path, then save the keyword
+# detections and the CPU load of the Sample App during the recording
+replay_recording() {
+  local RECORDING=$1
+  local LABELS="${RECORDING%.wav}.txt"
+  local SINCE=$(sample_app_log_offset)
+  local START_TICKS=$(sample_app_cpu_ticks $PID)
+  local PLAY_START=$EPOCHREALTIME
+  aplay -q -D avs_replay_playback "$RECORDING"
+  sleep $DETECTION_TIMEOUT
+  local PLAY_END=$EPOCHREALTIME
+  local END_TICKS=$(sample_app_cpu_ticks $PID)
+  local DETECTIONS=$(sample_app_log_after $SINCE | awk -v pattern="$SAMPLE_APP_DETECTION_PATTERN" -v start=$PLAY_START \
+    '$0 ~ pattern { printf "%s%.3f", (n++ > 0 ? " " : ""), $1 - start }')
+  local CPU_PERCENT=$(awk -v ticks=$(( END_TICKS - START_TICKS )) -v hz=$CLOCK_TICKS -v start=$PLAY_START -v end=$PLAY_END \
+    'BEGIN { printf "%.1f", 100 * ticks / hz / (end - start) }')
+  local KEYWORDS=
+  local LATENCIES=
+  # Match each labelled keyword with the first detection after it
+  if [ -f "$LABELS" ]; then
+    KEYWORDS=$(grep -c '[0-9]' "$LABELS")
+    LATENCIES=$(echo "$DETECTIONS" | awk -v timeout=$DETECTION_TIMEOUT '
+      NR == FNR { for (i = 1; i <= NF; ++i) detection[++n] = $i; next }
+      /[0-9]/ {
+        for (i = 1; i <= n; ++i) {
+          if (!used[i] && detection[i] >= $1 && detection[i] <= $1 + timeout) {
+            used[i] = 1
+            printf "%s%.3f", (m++ > 0 ? " " : ""), detection[i] - $1
+            break
+          }
+        }
+      }' - "$LABELS")
+    for LATENCY in $LATENCIES; do
+      echo $LATENCY >> $LATENCIES_FILE
+    done
+  fi
+  echo "$(basename "$RECORDING"),$(awk -v start=$PLAY_START -v end=$PLAY_END -v timeout=$DETECTION_TIMEOUT 'BEGIN { printf "%.3f", end - start - timeout }'),$(echo $DETECTIONS | wc -w),$KEYWORDS,$(echo $LATENCIES | wc -w),$CPU_PERCENT,$DETECTIONS,$LATENCIES" >> $RESULTS_FILE
+}
+
+write_report() {
+  cat << EOT > $REPORT_FILE
+{
+  "device": "$DEVICE",
+  "detector": "$DETECTOR",
+  "avs_device_sdk_tag": "$(installed_avs_device_sdk_tag)",
+  "recordings": $(( $(wc -l < $RESULTS_FILE) - 1 )),
+  "detections": $(awk -F, 'NR > 1 { n += $3 } END { print n + 0 }' $RESULTS_FILE),
+  "keywords": $(awk -F, 'NR > 1 { n += $4 } END { print n + 0 }' $RESULTS_FILE),
+  "detected_keywords": $(awk -F, 'NR > 1 { n += $5 } END { print n + 0 }' $RESULTS_FILE),
+  "mean_cpu_percent": $(awk -F, 'NR > 1 { n++; cpu += $6 } END { printf "%.1f", (n == 0 ? 0 : cpu / n) }' $RESULTS_FILE),
+  "detection_latency_s": $(latency_summary < $LATENCIES_FILE)
+}
+EOT
+}
+
+if pgrep -x SampleApp > /dev/null; then
+  echo "error: the Sample App is already running."
+  exit 1
+fi
+if ! use_loopback; then
+  echo "error: cannot load the ALSA loopback driver."
+  exit 1
+fi
+
+echo "recording,duration_s,detections,keywords,detected_keywords,cpu_percent,detection_times_s,detection_latencies_s" > $RESULTS_FILE
+rm -f $LATENCIES_FILE
+touch $LATENCIES_FILE
+echo "Starting the Sample App..."
+if ! start_sample_app $OUTPUT_DIR/$RUN_NAME.log; then
+  exit 1
+fi
+PID=$(pgrep -xo SampleApp)
+for RECORDING in "$RECORDINGS_DIR"/*.wav; do
+  echo "Replaying $(basename "$RECORDING")"
+  replay_recording "$RECORDING"
+done
+stop_sample_app
+restore_alsa_config
+trap - EXIT
+
+write_report
+rm -f $LATENCIES_FILE
+echo "Replay report saved in $REPORT_FILE"
+cat $REPORT_FILE
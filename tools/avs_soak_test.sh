@@ -0,0 +1,280 @@
+#!/usr/bin/env bash
+# Copyright 2021 XMOS LIMITED. This software is subject to the terms of the
+# XMOS Public Licence, Version 1
+source "$( dirname "${BASH_SOURCE[0]}" )/avs_common.sh"
+
+# Default number of hours the soak test runs for
+DURATION_HOURS=24
+# Default number of seconds between the samples, an utterance being played
+# before each sample
+SAMPLE_INTERVAL=60
+# Default number of seconds to wait for the response to an utterance
+RESPONSE_TIMEOUT=20
+# Default limits of the growth of the Sample App resident memory, in MB per
+# day, and of the drift of the response latency over the test, in ms
+MAX_MEMORY_GROWTH_MB_PER_DAY=10
+MAX_LATENCY_DRIFT_MS=500
+# Play the utterances on the default ALSA device by default
+APLAY_DEVICE_ARGS=
+OUTPUT_DIR=$SETUP_DIR/soak
+
+usage() {
+  cat <<EOT
+usage: avs_soak_test.sh <CORPUS-DIR> [OPTIONS]
+
+Run the Sample App installed by auto_install.sh for a number of hours,
+playing the next WAV file of the CORPUS-DIR, such as "Alexa, what time is
+it?", through the speakers every interval. After each utterance, the
+response latency, from the end of the utterance to the first audio out,
+and the resident memory and CPU load of the Sample App, the CPU temperature
+and throttle state, and the number of audio xruns are sampled.
+
+At the end of the test, the trends of the samples are reported, and the test
+fails if the resident memory grows faster than the memory growth limit, if
+the response latency drifts by more than the latency drift limit, or if the
+Sample App stops. The samples and the JSON report are saved in the output
+directory, named after the device type and keyword detector installed.
+
+Optional parameters:
+  -D <alsa-device>    ALSA device to play the utterances on
+  -d <hours>          Number of hours the test runs for, default is
+                      $DURATION_HOURS
+  -i <interval>       Number of seconds between the samples, default is
+                      $SAMPLE_INTERVAL
+  -l <ms>             Limit of the response latency drift over the test,
+                      default is $MAX_LATENCY_DRIFT_MS
+  -m <mb-per-day>     Limit of the resident memory growth, default is
+                      $MAX_MEMORY_GROWTH_MB_PER_DAY
+  -o <output-dir>     Output directory, default is $OUTPUT_DIR
+  -t <timeout>        Number of seconds to wait for the response to an
+                      utterance, default is $RESPONSE_TIMEOUT
+  -h                  Display this help and exit
+EOT
+}
+
+if [ $# -lt 1 ] || [ $1 == '-h' ]; then
+  usage
+  exit 1
+fi
+
+CORPUS_DIR=$1
+shift 1
+
+OPTIONS=D:d:i:l:m:o:t:h
+while getopts "$OPTIONS" opt ; do
+    case $opt in
+        D )
+            APLAY_DEVICE_ARGS="-D $OPTARG"
+            ;;
+        d )
+            DURATION_HOURS="$OPTARG"
+            ;;
+        i )
+            SAMPLE_INTERVAL="$OPTARG"
+            ;;
+        l )
+            MAX_LATENCY_DRIFT_MS="$OPTARG"
+            ;;
+        m )
+            MAX_MEMORY_GROWTH_MB_PER_DAY="$OPTARG"
+            ;;
+        o )
+            OUTPUT_DIR="$OPTARG"
+            ;;
+        t )
+            RESPONSE_TIMEOUT="$OPTARG"
+            ;;
+        h )
+            usage
+            exit 1
+            ;;
+    esac
+done
+
+if ! ls "$CORPUS_DIR"/*.wav > /dev/null 2>&1; then
+  echo "error: no WAV files found in $CORPUS_DIR."
+  exit 1
+fi
+
+for VALUE in $SAMPLE_INTERVAL $RESPONSE_TIMEOUT; do
+  if [[ ! "$VALUE" =~ ^[1-9][0-9]*$ ]]; then
+    echo "error: $VALUE is not a valid number of seconds."
+    echo
+    usage
+    exit 1
+  fi
+done
+for VALUE in $DURATION_HOURS $MAX_LATENCY_DRIFT_MS $MAX_MEMORY_GROWTH_MB_PER_DAY; do
+  if [[ ! "$VALUE" =~ ^[0-9]+([.][0-9]+)?$ ]]; then
+    echo "error: $VALUE is not a valid number."
+    echo
+    usage
+    exit 1
+  fi
+done
+
+DEVICE=$(installed_device)
+DETECTOR=$(installed_detector)
+if [ -z "$DEVICE" ]; then
+  echo "error: the AVS SDK has not been installed by auto_install.sh."
+  exit 1
+fi
+
+mkdir -p "$OUTPUT_DIR"
+RUN_NAME=soak_${DEVICE}_${DETECTOR}
+SAMPLES_FILE=$OUTPUT_DIR/$RUN_NAME.csv
+REPORT_FILE=$OUTPUT_DIR/$RUN_NAME.json
+CLOCK_TICKS=$(getconf CLK_TCK)
+
+# Play an utterance and wait for the Sample App to respond to it and return
+# to idle, then print the response latency, or nothing if there was none
+play_utterance() {
+  local SINCE=$(sample_app_log_offset)
+  aplay -q $APLAY_DEVICE_ARGS "$1"
+  local PLAY_END=$EPOCHREALTIME
+  local AUDIO_OUT=$(wait_for_marker "$SAMPLE_APP_AUDIO_OUT_PATTERN" $SINCE $RESPONSE_TIMEOUT)
+  if [ -n "$AUDIO_OUT" ]; then
+    wait_for_marker "$SAMPLE_APP_IDLE_PATTERN" ${AUDIO_OUT% *} $RESPONSE_TIMEOUT > /dev/null
+    awk -v start=$PLAY_END -v end=${AUDIO_OUT#* } 'BEGIN { printf "%.3f", end - start }'
+  else
+    wait_for_marker "$SAMPLE_APP_IDLE_PATTERN" $SINCE $RESPONSE_TIMEOUT > /dev/null
+  fi
+}
+
+# Sample the Sample App and the Raspberry Pi after an utterance
+sample_soak() {
+  local PID=$1
+  local ELAPSED=$2
+  local LATENCY=$3
+  local SAMPLE_TIME=$EPOCHREALTIME
+  local CPU_TICKS=$(sample_app_cpu_ticks $PID)
+  local RSS_KB=$(awk '/^VmRSS:/ { print $2 }' /proc/$PID/status 2> /dev/null)
+  local TEMP_C=
+  local THROTTLED=
+  local CPU_PERCENT=
+  if [ -f /sys/class/thermal/thermal_zone0/temp ]; then
+    TEMP_C=$(awk '{ printf "%.1f", $1 / 1000 }' /sys/class/thermal/thermal_zone0/temp)
+  fi
+  if command -v vcgencmd > /dev/null; then
+    THROTTLED=$(( $(vcgencmd get_throttled | cut -d= -f2) ))
+  fi
+  if [ -n "$CPU_TICKS" ]; then
+    CPU_PERCENT=$(awk -v ticks=$(( CPU_TICKS - LAST_CPU_TICKS )) -v hz=$CLOCK_TICKS -v start=$LAST_SAMPLE_TIME -v end=$SAMPLE_TIME \
+      'BEGIN { printf "%.1f", 100 * ticks / hz / (end - start) }')
+    LAST_CPU_TICKS=$CPU_TICKS
+  fi
+  LAST_SAMPLE_TIME=$SAMPLE_TIME
+  # Count the xruns of the Sample App log since the last sample
+  local LOG_OFFSET=$(sample_app_log_offset)
+  XRUNS=$(( XRUNS + $(count_markers "$SAMPLE_APP_XRUN_PATTERN" $XRUNS_LOG_OFFSET $LOG_OFFSET) ))
+  XRUNS_LOG_OFFSET=$LOG_OFFSET
+  echo "$ELAPSED,$LATENCY,$RSS_KB,$CPU_PERCENT,$TEMP_C,$THROTTLED,$XRUNS" >> $SAMPLES_FILE
+}
+
+# Print the trends of the samples and whether they are within the limits,
+# as the fields of a JSON object. The memory growth and the latency drift are
+# the slopes of the least squares lines through the samples.
+soak_trends() {
+  awk -F, -v max_growth=$MAX_MEMORY_GROWTH_MB_PER_DAY -v max_drift=$MAX_LATENCY_DRIFT_MS -v stopped="$SAMPLE_APP_STOPPED" '
+    function slope(n, sx, sy, sxx, sxy) {
+      return (n < 2 || n * sxx == sx * sx) ? 0 : (n * sxy - sx * sy) / (n * sxx - sx * sx)
+    }
+    function bitwise_or(a, b,    result, bit) {
+      result = 0
+      for (bit = 1; a > 0 || b > 0; bit *= 2) {
+        if (a % 2 == 1 || b % 2 == 1) result += bit
+        a = int(a / 2)
+        b = int(b / 2)
+      }
+      return result
+    }
+    NR > 1 {
+      hours = $1 / 3600
+      last_hours = hours
+      if ($2 != "") {
+        ln++; lsx += hours; lsy += $2; lsxx += hours * hours; lsxy += hours * $2
+      }
+      if ($3 != "") {
+        mn++; msx += hours; msy += $3; msxx += hours * hours; msxy += hours * $3
+        if (first_rss == "") first_rss = $3
+        last_rss = $3
+      }
+      if ($4 != "") {
+        cn++; cpu_sum += $4
+        if (cn == 1 || $4 > cpu_max) cpu_max = $4
+      }
+      if ($5 != "" && (temp_max == "" || $5 > temp_max)) temp_max = $5
+      if ($6 != "") throttled = bitwise_or(throttled, $6)
+      xruns = $7
+      samples++
+    }
+    END {
+      growth = slope(mn, msx, msy, msxx, msxy) * 24 / 1024
+      drift = slope(ln, lsx, lsy, lsxx, lsxy) * last_hours * 1000
+      passed = (stopped == "" && growth <= max_growth && (drift < 0 ? -drift : drift) <= max_drift)
+      printf "  \"samples\": %d,\n", samples
+      printf "  \"responses\": %d,\n", ln
+      printf "  \"sample_app_stopped\": %s,\n", (stopped == "" ? "false" : "true")
+      printf "  \"resident_memory_kb\": { \"first\": %s, \"last\": %s, \"growth_mb_per_day\": %.3f, \"limit_mb_per_day\": %s },\n",
+        (first_rss == "" ? "null" : first_rss), (last_rss == "" ? "null" : last_rss), growth, max_growth
+      printf "  \"response_latency\": { \"drift_ms\": %.1f, \"limit_ms\": %s },\n", drift, max_drift
+      printf "  \"cpu_percent\": { \"mean\": %s, \"max\": %s },\n", (cn == 0 ? "null" : sprintf("%.1f", cpu_sum / cn)), (cn == 0 ? "null" : cpu_max)
+      printf "  \"peak_cpu_temperature_c\": %s,\n", (temp_max == "" ? "null" : temp_max)
+      printf "  \"throttled\": \"0x%x\",\n", throttled
+      printf "  \"xruns\": %d,\n", xruns
+      printf "  \"passed\": %s\n", (passed ? "true" : "false")
+    }' $SAMPLES_FILE
+}
+
+write_report() {
+  cat << EOT > $REPORT_FILE
+{
+  "device": "$DEVICE",
+  "detector": "$DETECTOR",
+  "avs_device_sdk_tag": "$(installed_avs_device_sdk_tag)",
+  "duration_hours": $DURATION_HOURS,
+  "response_latency_s": $(awk -F, 'NR > 1 && $2 != "" { print $2 }' $SAMPLES_FILE | latency_summary),
+$(soak_trends)
+}
+EOT
+}
+
+echo "elapsed_s,response_latency_s,resident_memory_kb,cpu_percent,cpu_temperature_c,throttled,xruns" > $SAMPLES_FILE
+echo "Starting the Sample App..."
+if ! start_sample_app $OUTPUT_DIR/$RUN_NAME.log; then
+  exit 1
+fi
+PID=$(pgrep -xo SampleApp)
+LAST_CPU_TICKS=$(sample_app_cpu_ticks $PID)
+LAST_SAMPLE_TIME=$EPOCHREALTIME
+XRUNS_LOG_OFFSET=$(sample_app_log_offset)
+XRUNS=$(count_markers "$SAMPLE_APP_XRUN_PATTERN" 0 $XRUNS_LOG_OFFSET)
+SAMPLE_APP_STOPPED=
+START=$SECONDS
+END=$(awk -v start=$START -v hours=$DURATION_HOURS 'BEGIN { printf "%d", start + hours * 3600 }')
+UTTERANCES=("$CORPUS_DIR"/*.wav)
+i=0
+echo "Running the soak test for $DURATION_HOURS hours, see $SAMPLES_FILE"
+while [ $SECONDS -lt $END ]; do
+  NEXT=$(( SECONDS + SAMPLE_INTERVAL ))
+  UTTERANCE=${UTTERANCES[i++ % ${#UTTERANCES[@]}]}
+  LATENCY=$(play_utterance "$UTTERANCE")
+  if ! kill -0 $PID 2> /dev/null; then
+    echo "error: the Sample App has stopped."
+    SAMPLE_APP_STOPPED=y
+    break
+  fi
+  sample_soak $PID $(( SECONDS - START )) "$LATENCY"
+  if [ $NEXT -gt $SECONDS ]; then
+    sleep $(( NEXT - SECONDS ))
+  fi
+done
+stop_sample_app
+
+write_report
+echo "Soak test report saved in $REPORT_FILE"
+cat $REPORT_FILE
+if ! grep -q '"passed": true' $REPORT_FILE; then
+  echo "error: the soak test failed."
+  exit 1
+fi
@@ -0,0 +1,234 @@
+#!/usr/bin/env bash
+# Copyright 2021 XMOS LIMITED. This software is subject to the terms of the
+# XMOS Public Licence, Version 1
+source "$( dirname "${BASH_SOURCE[0]}" )/avs_common.sh"
+
+# Default range of Sensory operating points to evaluate
+FIRST_OPERATING_POINT=1
+LAST_OPERATING_POINT=20
+# Default maximum number of false accepts per hour of the chosen point
+MAX_FALSE_ACCEPTS_PER_HOUR=1
+# Default number of seconds to wait for the keyword detection of a positive
+DETECTION_TIMEOUT=5
+# Default number of seconds to wait for the Sample App to return to idle
+RESPONSE_TIMEOUT=20
+# Write the chosen operating point into the startup script by default
+DRY_RUN=
+# Play the corpus on the default ALSA device by default
+APLAY_DEVICE_ARGS=
+OUTPUT_DIR=$SETUP_DIR/tuning
+# Duration of the audio frames, in milliseconds, for the CPU use per frame
+FRAME_MS=10
+
+usage() {
+  cat <<EOT
+usage: avs_tune_sensory.sh <POSITIVES-DIR> <NEGATIVES-DIR> [OPTIONS]
+
+Choose the operating point of the Sensory keyword engine of the Sample App
+installed by auto_install.sh, instead of editing the third argument to
+SampleApp in $AVSRUN_SCRIPT by hand.
+
+For each operating point, the Sample App is started with that point and
+the labelled corpus is played through the speakers:
+   POSITIVES-DIR    WAV files each starting with the keyword
+   NEGATIVES-DIR    WAV files of background noise, speech or TV without
+                    the keyword
+
+The false reject rate of the positives, the false accepts per hour of the
+negatives and the CPU time of the Sample App per ${FRAME_MS}ms audio frame
+are saved in the output directory. The operating point with the lowest
+false reject rate within the maximum false accepts per hour is then
+written into the startup script.
+
+Optional parameters:
+  -a <false-accepts>  Maximum false accepts per hour of the chosen point,
+                      default is $MAX_FALSE_ACCEPTS_PER_HOUR
+  -D <alsa-device>    ALSA device to play the corpus on
+  -n                  Flag to only report, without changing the startup script
+  -o <output-dir>     Output directory, default is $OUTPUT_DIR
+  -r <first>-<last>   Range of operating points to evaluate, default is
+                      $FIRST_OPERATING_POINT-$LAST_OPERATING_POINT
+  -h                  Display this help and exit
+EOT
+}
+
+if [ $# -lt 2 ] || [ $1 == '-h' ]; then
+  usage
+  exit 1
+fi
+
+POSITIVES_DIR=$1
+NEGATIVES_DIR=$2
+shift 2
+
+OPTIONS=a:D:no:r:h
+while getopts "$OPTIONS" opt ; do
+    case $opt in
+        a )
+            MAX_FALSE_ACCEPTS_PER_HOUR="$OPTARG"
+            ;;
+        D )
+            APLAY_DEVICE_ARGS="-D $OPTARG"
+            ;;
+        n )
+            DRY_RUN=y
+            ;;
+        o )
+            OUTPUT_DIR="$OPTARG"
+            ;;
+        r )
+            FIRST_OPERATING_POINT="${OPTARG%-*}"
+            LAST_OPERATING_POINT="${OPTARG#*-}"
+            ;;
+        h )
+            usage
+            exit 1
+            ;;
+    esac
+done
+
+for DIR in "$POSITIVES_DIR" "$NEGATIVES_DIR"; do
+  if ! ls "$DIR"/*.wav > /dev/null 2>&1; then
+    echo "error: no WAV files found in $DIR."
+    exit 1
+  fi
+done
+
+if [ "$(installed_detector)" != "sensory" ]; then
+  echo "error: the AVS SDK has been installed with the $(installed_detector) keyword detector, not Sensory."
+  exit 1
+fi
+
+# Print the operating point given to SampleApp by the startup script
+get_operating_point() {
+  awk '{ for (i = 1; i < NF; i++) if ($i ~ /SampleApp$/ && i + 3 <= NF) { print $(i + 3); exit } }' $AVSRUN_SCRIPT
+}
+
+# Change the operating point given to SampleApp by the startup script
+set_operating_point() {
+  local TEMP_FILE=$(mktemp)
+  awk -v point=$1 '{
+    for (i = 1; i < NF; i++) {
+      if ($i ~ /SampleApp$/ && i + 3 <= NF) {
+        $(i + 3) = point
+        break
+      }
+    }
+    print
+  }' $AVSRUN_SCRIPT > $TEMP_FILE
+  cat $TEMP_FILE > $AVSRUN_SCRIPT
+  rm -f $TEMP_FILE
+}
+
+# Print the duration of a WAV file in seconds
+wav_duration() {
+  local BYTE_RATE=$(od -An -t u4 -j 28 -N 4 "$1")
+  echo "$(stat -c %s "$1") $BYTE_RATE" | awk '{ printf "%.3f", ($1 - 44) / $2 }'
+}
+
+# Count the keyword detections in the Sample App log from the given offset
+count_detections() {
+  count_markers "$SAMPLE_APP_DETECTION_PATTERN" $1 $(sample_app_log_offset)
+}
+
+# Play the corpus with the Sample App running at the given operating point
+# and save its results
+evaluate_operating_point() {
+  local POINT=$1
+  local POSITIVES=0
+  local FALSE_REJECTS=0
+  local NEGATIVE_SECONDS=0
+  local FALSE_ACCEPTS=0
+  local AUDIO_SECONDS=0
+  local FILE SINCE DETECTIONS
+  set_operating_point $POINT
+  if ! start_sample_app $OUTPUT_DIR/sample_app_$POINT.log; then
+    return 1
+  fi
+  local PID=$(pgrep -xo SampleApp)
+  local CPU_START=$(sample_app_cpu_ticks $PID)
+  for FILE in "$POSITIVES_DIR"/*.wav; do
+    SINCE=$(sample_app_log_offset)
+    aplay -q $APLAY_DEVICE_ARGS "$FILE"
+    (( ++POSITIVES ))
+    if wait_for_marker "$SAMPLE_APP_DETECTION_PATTERN" $SINCE $DETECTION_TIMEOUT > /dev/null; then
+      wait_for_marker "$SAMPLE_APP_IDLE_PATTERN" $SINCE $RESPONSE_TIMEOUT > /dev/null
+    else
+      (( ++FALSE_REJECTS ))
+    fi
+    AUDIO_SECONDS=$(echo "$AUDIO_SECONDS $(wav_duration "$FILE")" | awk '{ print $1 + $2 }')
+  done
+  for FILE in "$NEGATIVES_DIR"/*.wav; do
+    SINCE=$(sample_app_log_offset)
+    aplay -q $APLAY_DEVICE_ARGS "$FILE"
+    DETECTIONS=$(count_detections $SINCE)
+    if [ $DETECTIONS -gt 0 ]; then
+      wait_for_marker "$SAMPLE_APP_IDLE_PATTERN" $(sample_app_log_offset) $RESPONSE_TIMEOUT > /dev/null
+    fi
+    FALSE_ACCEPTS=$(( FALSE_ACCEPTS + DETECTIONS ))
+    NEGATIVE_SECONDS=$(echo "$NEGATIVE_SECONDS $(wav_duration "$FILE")" | awk '{ print $1 + $2 }')
+  done
+  AUDIO_SECONDS=$(echo "$AUDIO_SECONDS $NEGATIVE_SECONDS" | awk '{ print $1 + $2 }')
+  local CPU_END=$(sample_app_cpu_ticks $PID)
+  stop_sample_app
+  echo "$POINT $POSITIVES $FALSE_REJECTS $NEGATIVE_SECONDS $FALSE_ACCEPTS $AUDIO_SECONDS $CPU_START $CPU_END" |
+    awk -v frame_ms=$FRAME_MS -v hz=$(getconf CLK_TCK) '{
+      printf "%d,%d,%d,%.4f,%.3f,%d,%.3f,%.4f\n", $1, $2, $3, $3 / $2, $4 / 3600, $5, ($4 > 0 ? $5 * 3600 / $4 : 0),
+        ($6 > 0 ? ($8 - $7) * 1000 / hz / ($6 * 1000 / frame_ms) : 0)
+    }' >> $RESULTS_FILE
+}
+
+# Print the operating point with the lowest false reject rate within the
+# maximum false accepts per hour, or the lowest false accepts per hour if
+# there is none
+choose_operating_point() {
+  awk -F, -v max_false_accepts=$MAX_FALSE_ACCEPTS_PER_HOUR 'NR > 1 {
+    if ($7 <= max_false_accepts && (best == "" || $4 < best_false_reject_rate)) {
+      best = $1
+      best_false_reject_rate = $4
+    }
+    if (fallback == "" || $7 < fallback_false_accepts) {
+      fallback = $1
+      fallback_false_accepts = $7
+    }
+  }
+  END { print (best != "" ? best : fallback) }' $RESULTS_FILE
+}
+
+mkdir -p "$OUTPUT_DIR"
+RESULTS_FILE=$OUTPUT_DIR/sensory_operating_points.csv
+ORIGINAL_OPERATING_POINT=$(get_operating_point)
+if [ -z "$ORIGINAL_OPERATING_POINT" ]; then
+  echo "error: cannot find the operating point in $AVSRUN_SCRIPT."
+  exit 1
+fi
+
+# Stop the Sample App and restore the original operating point if the tuning
+# is stopped before the end, such as with Ctrl-C
+restore_operating_point() {
+  if [ -n "$SAMPLE_APP_PID" ] && kill -0 $SAMPLE_APP_PID 2> /dev/null; then
+    stop_sample_app
+  fi
+  set_operating_point $ORIGINAL_OPERATING_POINT
+}
+trap restore_operating_point EXIT
+trap 'exit 1' INT TERM
+
+echo "operating_point,positives,false_rejects,false_reject_rate,negative_hours,false_accepts,false_accepts_per_hour,cpu_ms_per_frame" > $RESULTS_FILE
+for (( POINT = FIRST_OPERATING_POINT; POINT <= LAST_OPERATING_POINT; ++POINT )); do
+  echo "Evaluating Sensory operating point $POINT..."
+  if ! evaluate_operating_point $POINT; then
+    exit 1
+  fi
+done
+tr , "\t" < $RESULTS_FILE
+
+CHOSEN_OPERATING_POINT=$(choose_operating_point)
+trap - EXIT INT TERM
+if [ -n "$DRY_RUN" ]; then
+  set_operating_point $ORIGINAL_OPERATING_POINT
+  echo "Sensory operating point $CHOSEN_OPERATING_POINT chosen, $AVSRUN_SCRIPT left unchanged"
+else
+  set_operating_point $CHOSEN_OPERATING_POINT
+  echo "Sensory operating point $CHOSEN_OPERATING_POINT written into $AVSRUN_SCRIPT"
+fi
@@ -0,0 +1,56 @@
+# Copyright 2021 XMOS LIMITED. This software is subject to the terms of the
+# XMOS Public Licence, Version 1
+#
+# Common definitions for the scripts installing the setup on Raspberry Pis
+# over SSH. This file is sourced by fleet_install.sh and validate_devices.sh.
+
+# Directory of the setup on each Raspberry Pi, relative to the home directory
+REMOTE_SETUP_DIR=vocalfusion-avs-setup
+# Files of the setup copied to each Raspberry Pi
+SETUP_FILES="auto_install.sh config.json tools"
+# SSH options for unattended installs
+SSH_OPTIONS="-o BatchMode=yes -o ConnectTimeout=10"
+# Default number of Raspberry Pis installed at the same time
+PARALLEL_INSTALLS=8
+
+# Print the two fields of each line of a CSV file of Raspberry Pis, skipping
+# comments, blank lines and the header line starting with the given name
+fleet_targets() {
+  sed -e 's/#.*//' -e 's/[[:space:]]//g' $1 |
+    awk -F, -v header=$2 'NF >= 2 && $1 != "" && $2 != "" && tolower($1) != header { print $1, $2 }'
+}
+
+# Copy the setup, and the prebuilt artifact of ARTIFACT_DIR if it is set, to
+# a Raspberry Pi
+push_setup() {
+  local HOST=$1
+  tar -cz -C $SETUP_DIR $SETUP_FILES |
+    ssh $SSH_OPTIONS $HOST "mkdir -p $REMOTE_SETUP_DIR/artifact && tar -xz -C $REMOTE_SETUP_DIR" || return 1
+  if [ -n "$ARTIFACT_DIR" ]; then
+    scp -q $SSH_OPTIONS $ARTIFACT_DIR/*.tar.gz $ARTIFACT_DIR/*.sha256 $HOST:$REMOTE_SETUP_DIR/artifact/
+  fi
+}
+
+# Print the given arguments quoted for the shell of a Raspberry Pi
+remote_args() {
+  local ARG
+  for ARG in "$@"; do
+    printf " %q" "$ARG"
+  done
+}
+
+# Run the given function with the two fields of each line of targets, for up
+# to PARALLEL_INSTALLS targets at the same time
+run_on_targets() {
+  local FUNCTION=$1
+  local TARGETS=$2
+  local FIRST
+  local SECOND
+  while read FIRST SECOND; do
+    while [ $(jobs -rp | wc -l) -ge $PARALLEL_INSTALLS ]; do
+      wait -n
+    done
+    $FUNCTION $FIRST $SECOND &
+  done <<< "$TARGETS"
+  wait
+}
@@ -0,0 +1,343 @@
+#!/usr/bin/env bash
+# Copyright 2021 XMOS LIMITED. This software is subject to the terms of the
+# XMOS Public Licence, Version 1
+pushd "$( dirname "${BASH_SOURCE[0]}" )" > /dev/null
+SETUP_DIR="$( pwd )"
+source $SETUP_DIR/tools/fleet_common.sh
+
+# Device types and release tags validated, as installed by auto_install.sh
+VALID_XMOS_DEVICES=$(sed -n 's/^VALID_XMOS_DEVICES="\(.*\)"$/\1/p' auto_install.sh)
+AVS_DEVICE_SDK_TAG=$(sed -n 's/^AVS_DEVICE_SDK_TAG="\(.*\)"$/\1/p' auto_install.sh)
+RPI_SETUP_TAG=$(sed -n 's/^RPI_SETUP_TAG="\(.*\)"$/\1/p' auto_install.sh)
+# Build the AVS SDK artifacts on this Raspberry Pi by default, rather than in
+# a container of cross_build.sh
+CROSS_BUILD_ARCH=
+# Disable compiler cache by default
+CCACHE_DIR=
+# Do not run the latency benchmark by default
+CORPUS_DIR=
+# Number of seconds to wait for a Raspberry Pi to reboot
+REBOOT_TIMEOUT=300
+OUTPUT_DIR=$SETUP_DIR/validation
+
+usage() {
+  cat <<EOT
+usage: validate_devices.sh <RACK-FILE> [OPTIONS] [-- INSTALL-OPTIONS]
+
+Validate the install of every device type of the RACK-FILE, such as after a
+change of the release tags, on a rack of Raspberry Pis with one device each.
+The AVS SDK artifact of each device type is built in turn on this Raspberry
+Pi, sharing the compiler cache so that only the first build is a full
+build. The device-specific stages, the Raspberry Pi setup and the AVS SDK
+install and configuration by auto_install.sh, are then run on every
+Raspberry Pi of the rack in parallel over SSH.
+
+The RACK-FILE is a CSV file with a line for each Raspberry Pi:
+   <device-type>,<[user@]host>
+where the device type is one of: $VALID_XMOS_DEVICES
+
+After its install, each Raspberry Pi is rebooted and the frontend benchmark
+is run on it, followed by the latency benchmark of the given corpus. The
+Raspberry Pis must accept SSH connections without a password, and their
+user must have the same home directory as the user of this Raspberry Pi.
+The INSTALL-OPTIONS are passed to auto_install.sh for every build and
+install. The builds ask for the AVS SDK and Sensory license agreements, so
+validate_devices.sh must be run from a terminal.
+
+The log of each build and Raspberry Pi, and validation_report.json with the
+status and install time of each Raspberry Pi, its install report and its
+benchmark reports, are saved in the output directory.
+
+Optional parameters:
+  -c <cache-dir>      Compile the AVS SDK through ccache, keeping the cache
+                      shared by the builds in the given directory
+  -C <corpus-dir>     Run the latency benchmark with the corpus in the given
+                      directory of each Raspberry Pi, which must be
+                      registered with AVS
+  -o <output-dir>     Output directory, default is $OUTPUT_DIR
+  -P <installs>       Number of Raspberry Pis installed at the same time,
+                      default is $PARALLEL_INSTALLS
+  -X <arch>           Build the artifacts with cross_build.sh for the given
+                      Raspberry Pi OS architecture, armhf or aarch64, rather
+                      than on this Raspberry Pi
+  -h                  Display this help and exit
+EOT
+}
+
+if [ $# -lt 1 ] || [ $1 == '-h' ]; then
+    usage
+    exit 1
+fi
+
+RACK_FILE=$1
+shift 1
+
+OPTIONS=c:C:o:P:X:h
+while getopts "$OPTIONS" opt ; do
+    case $opt in
+        c )
+            CCACHE_DIR="$OPTARG"
+            ;;
+        C )
+            CORPUS_DIR="$OPTARG"
+            ;;
+        o )
+            OUTPUT_DIR="$OPTARG"
+            ;;
+        P )
+            PARALLEL_INSTALLS="$OPTARG"
+            ;;
+        X )
+            CROSS_BUILD_ARCH="$OPTARG"
+            ;;
+        h )
+            usage
+            exit 1
+            ;;
+    esac
+done
+shift $(( OPTIND - 1 ))
+INSTALL_ARGS=("$@")
+
+if [ ! -f "$RACK_FILE" ]; then
+  echo "error: rack file $RACK_FILE not found."
+  echo
+  usage
+  exit 1
+fi
+
+if [ ! -f config.json ]; then
+  echo "error: config JSON file not found."
+  echo
+  usage
+  exit 1
+fi
+
+if [[ ! "$PARALLEL_INSTALLS" =~ ^[1-9][0-9]*$ ]]; then
+  echo "error: $PARALLEL_INSTALLS is not a valid number of installs."
+  echo
+  usage
+  exit 1
+fi
+
+if [ -n "$CROSS_BUILD_ARCH" ] && [[ ! "$CROSS_BUILD_ARCH" =~ ^(armhf|aarch64)$ ]]; then
+  echo "error: $CROSS_BUILD_ARCH is not a valid architecture."
+  echo
+  usage
+  exit 1
+fi
+
+# The license agreements are accepted during the builds
+if [ ! -t 0 ]; then
+  echo "error: validate_devices.sh must be run from a terminal to accept the license agreements."
+  exit 1
+fi
+
+TARGETS=$(fleet_targets $RACK_FILE device)
+if [ -z "$TARGETS" ]; then
+  echo "error: no Raspberry Pis found in $RACK_FILE."
+  exit 1
+fi
+for DEVICE in $(echo "$TARGETS" | cut -d' ' -f1); do
+  if [[ ! " $VALID_XMOS_DEVICES " =~ " $DEVICE " ]]; then
+    echo "error: $DEVICE is not a valid device type."
+    echo
+    usage
+    exit 1
+  fi
+done
+
+if ! mkdir -p "$OUTPUT_DIR"; then
+  echo "error: cannot create output directory $OUTPUT_DIR."
+  exit 1
+fi
+OUTPUT_DIR="$( cd "$OUTPUT_DIR" && pwd )"
+REPORT_FILE=$OUTPUT_DIR/validation_report.json
+if [ -n "$CCACHE_DIR" ]; then
+  if ! mkdir -p "$CCACHE_DIR"; then
+    echo "error: cannot create ccache directory $CCACHE_DIR."
+    exit 1
+  fi
+  CCACHE_DIR="$( cd "$CCACHE_DIR" && pwd )"
+fi
+
+# Build the AVS SDK artifact of a device type in its own directory
+build_artifact() {
+  local DEVICE=$1
+  local DIR=$2
+  if [ -n "$CROSS_BUILD_ARCH" ]; then
+    ./cross_build.sh $DEVICE $DIR -a $CROSS_BUILD_ARCH ${CCACHE_DIR:+-c $CCACHE_DIR} -- "${INSTALL_ARGS[@]}"
+  else
+    ./auto_install.sh $DEVICE -S -o $DIR ${CCACHE_DIR:+-c $CCACHE_DIR} "${INSTALL_ARGS[@]}"
+  fi
+}
+
+# Wait for a rebooted Raspberry Pi to accept SSH connections again
+wait_for_reboot() {
+  local HOST=$1
+  local START=$(date +%s)
+  sleep 10
+  while ! ssh $SSH_OPTIONS $HOST true < /dev/null 2> /dev/null; do
+    if [ $(( $(date +%s) - START )) -ge $REBOOT_TIMEOUT ]; then
+      return 1
+    fi
+    sleep 5
+  done
+}
+
+# Run the latency benchmark on a Raspberry Pi, with the Sample App of the
+# avsrun service stopped while it runs
+run_latency_benchmark() {
+  local HOST=$1
+  local AVSRUN_ACTIVE=
+  local STATUS=0
+  if ssh $SSH_OPTIONS $HOST "systemctl is-active --quiet avsrun.service" < /dev/null; then
+    AVSRUN_ACTIVE=y
+    ssh $SSH_OPTIONS $HOST "sudo systemctl stop avsrun.service" < /dev/null
+  fi
+  ssh $SSH_OPTIONS $HOST "$REMOTE_SETUP_DIR/tools/avs_benchmark.sh$(remote_args "$CORPUS_DIR")" < /dev/null || STATUS=1
+  if [ -n "$AVSRUN_ACTIVE" ]; then
+    ssh $SSH_OPTIONS $HOST "sudo systemctl start avsrun.service" < /dev/null
+  fi
+  return $STATUS
+}
+
+# Install a Raspberry Pi of the rack from the artifact of its device type,
+# then reboot it and run the benchmarks, saving their reports in the given
+# directory. The install time is printed to the install_time file and the
+# stage which failed to the stage file.
+validate_target() {
+  local DEVICE=$1
+  local HOST=$2
+  local DIR=$3
+  local ARTIFACT_DIR=$OUTPUT_DIR/artifact/$DEVICE
+  local REMOTE_CMD="cd $REMOTE_SETUP_DIR && ./auto_install.sh $DEVICE -b \$HOME/$REMOTE_SETUP_DIR/artifact$(remote_args "${INSTALL_ARGS[@]}")"
+  echo "Pushing setup to $HOST"
+  ssh $SSH_OPTIONS $HOST "rm -rf $REMOTE_SETUP_DIR/artifact $REMOTE_SETUP_DIR/benchmark" < /dev/null
+  if ! push_setup $HOST; then
+    echo push > $DIR/stage
+    return 1
+  fi
+  echo "Running command $REMOTE_CMD on $HOST"
+  local START=$(date +%s)
+  ssh $SSH_OPTIONS $HOST "$REMOTE_CMD" < /dev/null
+  local INSTALL_STATUS=$?
+  echo $(( $(date +%s) - START )) > $DIR/install_time
+  scp -q $SSH_OPTIONS $HOST:$REMOTE_SETUP_DIR/install_report.json $DIR/
+  if [ $INSTALL_STATUS -ne 0 ]; then
+    echo install > $DIR/stage
+    return 1
+  fi
+  echo "Rebooting $HOST"
+  ssh $SSH_OPTIONS $HOST "sudo reboot" < /dev/null
+  if ! wait_for_reboot $HOST; then
+    echo reboot > $DIR/stage
+    return 1
+  fi
+  echo "Running frontend benchmark on $HOST"
+  if ! ssh $SSH_OPTIONS $HOST "$REMOTE_SETUP_DIR/tools/avs_frontend_benchmark.sh" < /dev/null ||
+     ! scp -q $SSH_OPTIONS "$HOST:$REMOTE_SETUP_DIR/benchmark/frontend_*.json" $DIR/frontend_benchmark.json; then
+    echo frontend_benchmark > $DIR/stage
+    return 1
+  fi
+  if [ -n "$CORPUS_DIR" ]; then
+    echo "Running latency benchmark on $HOST"
+    if ! run_latency_benchmark $HOST ||
+       ! scp -q $SSH_OPTIONS "$HOST:$REMOTE_SETUP_DIR/benchmark/benchmark_*.json" $DIR/latency_benchmark.json; then
+      echo latency_benchmark > $DIR/stage
+      return 1
+    fi
+  fi
+  return 0
+}
+
+# Validate a Raspberry Pi of the rack, recording its log, status, failed
+# stage and install time in its directory of the output directory
+run_target() {
+  local DEVICE=$1
+  local HOST=$2
+  local DIR=$OUTPUT_DIR/$DEVICE-${HOST#*@}
+  local STATUS=ok
+  rm -rf $DIR
+  mkdir -p $DIR
+  if [ ! -f $OUTPUT_DIR/artifact/$DEVICE.ok ]; then
+    echo build > $DIR/stage
+    STATUS=failed
+  else
+    if ! validate_target $DEVICE $HOST $DIR > $DIR/validation.log 2>&1; then
+      STATUS=failed
+    fi
+  fi
+  echo "$DEVICE,$HOST,$STATUS,$(cat $DIR/stage 2> /dev/null),$(cat $OUTPUT_DIR/artifact/$DEVICE.time),$(cat $DIR/install_time 2> /dev/null)" > $DIR/result
+  echo "$DEVICE on $HOST: $STATUS"
+}
+
+# Print the JSON of a report file, or null if it was not saved
+json_report() {
+  if [ -s $1 ]; then
+    sed -e '2,$s/^/      /' $1
+  else
+    echo null
+  fi
+}
+
+# Write the validation report with the result and reports of each Raspberry
+# Pi, in the order of the rack file
+write_report() {
+  local DEVICE
+  local HOST
+  local DIR
+  local SEP=
+  {
+    echo "{"
+    echo "  \"avs_device_sdk_tag\": \"$AVS_DEVICE_SDK_TAG\","
+    echo "  \"rpi_setup_tag\": \"$RPI_SETUP_TAG\","
+    printf "  \"targets\": ["
+    while read DEVICE HOST; do
+      DIR=$OUTPUT_DIR/$DEVICE-${HOST#*@}
+      IFS=, read DEVICE HOST STATUS STAGE BUILD_TIME INSTALL_TIME < $DIR/result
+      printf "%s\n    {\n" "$SEP"
+      echo "      \"device\": \"$DEVICE\","
+      echo "      \"host\": \"$HOST\","
+      echo "      \"status\": \"$STATUS\","
+      echo "      \"failed_stage\": $([ -n "$STAGE" ] && echo "\"$STAGE\"" || echo null),"
+      echo "      \"build_time_s\": ${BUILD_TIME:-null},"
+      echo "      \"install_time_s\": ${INSTALL_TIME:-null},"
+      echo "      \"install_report\": $(json_report $DIR/install_report.json),"
+      echo "      \"frontend_benchmark\": $(json_report $DIR/frontend_benchmark.json),"
+      echo "      \"latency_benchmark\": $(json_report $DIR/latency_benchmark.json)"
+      printf "    }"
+      SEP=,
+    done <<< "$TARGETS"
+    printf "\n  ]\n}\n"
+  } > $REPORT_FILE
+}
+
+# Build the artifact of each device type of the rack once, one after the
+# other as the builds share the SDK directory and the compiler cache. The
+# output of the builds is shown, for the license agreements, and saved.
+rm -rf $OUTPUT_DIR/artifact
+mkdir -p $OUTPUT_DIR/artifact
+for DEVICE in $(echo "$TARGETS" | cut -d' ' -f1 | sort -u); do
+  echo "Building AVS SDK for $DEVICE, see $OUTPUT_DIR/artifact/$DEVICE.log"
+  START=$(date +%s)
+  build_artifact $DEVICE $OUTPUT_DIR/artifact/$DEVICE 2>&1 | tee $OUTPUT_DIR/artifact/$DEVICE.log
+  if [ ${PIPESTATUS[0]} -eq 0 ] && ls $OUTPUT_DIR/artifact/$DEVICE/*.tar.gz > /dev/null 2>&1; then
+    touch $OUTPUT_DIR/artifact/$DEVICE.ok
+  else
+    echo "warning: cannot build AVS SDK for $DEVICE."
+  fi
+  echo $(( $(date +%s) - START )) > $OUTPUT_DIR/artifact/$DEVICE.time
+done
+
+echo "Validating $(echo "$TARGETS" | wc -l) Raspberry Pis, $PARALLEL_INSTALLS at a time"
+run_on_targets run_target "$TARGETS"
+
+write_report
+echo "Validation report saved in $REPORT_FILE"
+FAILED=$(grep -c "\"status\": \"failed\"" $REPORT_FILE)
+popd > /dev/null
+if [ $FAILED -gt 0 ]; then
+  echo "error: $FAILED Raspberry Pis failed validation."
+  exit 1
+fi